@@ -5,6 +5,7 @@
 #define BITMAP_HH
 
 //bitmap.hh
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cmath>
@@ -12,6 +13,12 @@
 #include <cstdlib>
 #include <cstring>
 
+#define BITMAP_TILE 32 // Pixels along each side of a tile, the unit of darkening and uploading
+
+// What may need doing to a tile
+#define TILE_LIT 1     // Some pixels may not be black, so darken it
+#define TILE_CHANGED 2 // Pixels changed since it was last shown, so upload it
+
 struct rgb32 {
   uint8_t alpha;
   uint8_t blue;
@@ -26,22 +33,69 @@ struct rgb32 {
 class bitmap {
 public:
   // Constructor: set up the bitmap width, height, and data array
-  bitmap(size_t width, size_t height) : _width(width), _height(height) {
+  bitmap(size_t width, size_t height) : _width(width), _height(height), _owned(true) {
     _data = new rgb32[width*height];
+    _tiles = new uint8_t[tileBytes(width, height)];
+    markAll();
+  }
+
+  // Constructor: draw into pixels and tile flags owned by someone else, e.g.
+  // shared memory. tiles needs tileBytes(width, height) bytes
+  bitmap(size_t width, size_t height, rgb32* data, uint8_t* tiles) :
+    _width(width), _height(height), _data(data), _tiles(tiles), _owned(false) {
+    markAll();
   }
   
   // Destructor: free the data array
   ~bitmap() {
-    delete _data;
+    if(_owned) {
+      delete[] _data;
+      delete[] _tiles;
+    }
   }
   
   // Get the size of this bitmap's image data
   size_t size() { return _width*_height*sizeof(rgb32); }
+
+  // Get the bytes of tile flags a bitmap of some size needs
+  static size_t tileBytes(size_t width, size_t height) {
+    return ((width + BITMAP_TILE - 1) / BITMAP_TILE) * ((height + BITMAP_TILE - 1) / BITMAP_TILE);
+  }
   
   // Copy this bitmap to a given data location
   void copy_to(void* dest) {
     memcpy(dest, _data, size());
   }
+
+  // Get the pixels, row by row
+  rgb32* data() { return _data; }
+
+  // Mark every tile as lit and changed, when we can't tell what changed
+  void markAll() {
+    memset(_tiles, TILE_LIT | TILE_CHANGED, tileBytes(_width, _height));
+  }
+
+  // Call fn(x, y, width, height) for every run of changed tiles along a row of
+  // tiles, clipped to the bitmap, and forget that they changed
+  template<typename F> void takeChanged(F fn) {
+    size_t cols = (_width + BITMAP_TILE - 1) / BITMAP_TILE;
+    size_t rows = (_height + BITMAP_TILE - 1) / BITMAP_TILE;
+    for(size_t ty=0; ty<rows; ty++) {
+      for(size_t tx=0; tx<cols; ) {
+        if(!(_tiles[ty*cols+tx] & TILE_CHANGED)) {
+          tx++;
+          continue;
+        }
+        size_t first = tx;
+        for(; tx<cols && (_tiles[ty*cols+tx] & TILE_CHANGED); tx++) {
+          _tiles[ty*cols+tx] &= ~TILE_CHANGED;
+        }
+        size_t x = first*BITMAP_TILE;
+        size_t y = ty*BITMAP_TILE;
+        fn((int)x, (int)y, (int)(std::min(tx*BITMAP_TILE, _width) - x), (int)(std::min(y+BITMAP_TILE, _height) - y));
+      }
+    }
+  }
   
   // Disallow the copy constructor for bitmaps
   bitmap(const bitmap&) = delete;
@@ -62,22 +116,46 @@ public:
     // Instead of failing assertions for out-of-bounds pixels, just ignore them
     if(x < 0 || x >= _width || y < 0 || y >= _height) return;
     _data[y*_width+x] = color;
+
+    // Several threads and processes may draw on a tile; they all set the same flags
+    uint8_t* tile = &_tiles[(y/BITMAP_TILE)*((_width + BITMAP_TILE - 1)/BITMAP_TILE) + x/BITMAP_TILE];
+    if(*tile != (TILE_LIT | TILE_CHANGED)) {
+      __atomic_store_n(tile, TILE_LIT | TILE_CHANGED, __ATOMIC_RELAXED);
+    }
   }
   
-  // Scale the color of each point by a given multiplier
+  // Scale the color of each point by a given multiplier. Only lit tiles can
+  // change, and a tile that is all black afterwards isn't lit any more
   void darken(float multiplier) {
-    for(int x=0; x<_width; x++) {
-      for(int y=0; y<_height; y++) {
-        _data[x+y*_width].alpha *= multiplier;
-        _data[x+y*_width].blue *= multiplier;
-        _data[x+y*_width].green *= multiplier;
-        _data[x+y*_width].red *= multiplier;
+    size_t cols = (_width + BITMAP_TILE - 1) / BITMAP_TILE;
+    size_t rows = (_height + BITMAP_TILE - 1) / BITMAP_TILE;
+    for(size_t ty=0; ty<rows; ty++) {
+      for(size_t tx=0; tx<cols; tx++) {
+        uint8_t& tile = _tiles[ty*cols+tx];
+        if(!(tile & TILE_LIT)) {
+          continue;
+        }
+        bool lit = false;
+        size_t x1 = std::min((tx+1)*BITMAP_TILE, _width);
+        size_t y1 = std::min((ty+1)*BITMAP_TILE, _height);
+        for(size_t y=ty*BITMAP_TILE; y<y1; y++) {
+          for(size_t x=tx*BITMAP_TILE; x<x1; x++) {
+            rgb32& p = _data[x+y*_width];
+            p.alpha *= multiplier;
+            p.blue *= multiplier;
+            p.green *= multiplier;
+            p.red *= multiplier;
+            lit = lit || p.blue || p.green || p.red;
+          }
+        }
+        tile = lit ? (TILE_LIT | TILE_CHANGED) : TILE_CHANGED;
       }
     }
   }
   
   // Shift all of the pixels in this bitmap up one position
   void shiftUp() {
+    markAll();
     for(int x=0; x<_width; x++) {
       for(int y=0; y<_height-1; y++) {
         _data[x+y*_width] = _data[x+(y+1)*_width];
@@ -91,6 +169,7 @@ public:
   
   // Shift all of the pixels in this bitmap down one position
   void shiftDown() {
+    markAll();
     for(int x=0; x<_width; x++) {
       for(int y=_height-1; y>0; y--) {
         _data[x+y*_width] = _data[x+(y-1)*_width];
@@ -104,6 +183,7 @@ public:
   
   // Shift all of the pixels in this bitmap left one position
   void shiftLeft() {
+    markAll();
     for(int x=0; x<_width-1; x++) {
       for(int y=0; y<_height; y++) {
         _data[x+y*_width] = _data[x+y*_width+1];
@@ -117,6 +197,7 @@ public:
   
   // Shift all of the pixels in this bitmap right one position
   void shiftRight() {
+    markAll();
     for(int x=_width-1; x>0; x--) {
       for(int y=0; y<_height; y++) {
         _data[x+y*_width] = _data[x+y*_width-1];
@@ -132,6 +213,8 @@ private:
   size_t _width;
   size_t _height;
   rgb32* _data;
+  uint8_t* _tiles; // TILE_LIT and TILE_CHANGED flags of each tile, row by row
+  bool _owned;
 };
 
 #endif
@@ -0,0 +1,163 @@
+/* capture.hh records the window to a video (--capture=FILE). The main      *
+ * thread only copies each finished frame into one of a few buffers, for a *
+ * writer thread (see handOff in threads.hh) to shrink and write out, as   *
+ * Y4M for a FILE ending in .y4m and raw RGBA otherwise, to a file or, for  *
+ * "|command", down a pipe. A shown frame that finds no buffer spare is    *
+ * dropped. Headless runs, which have no window to keep up with, draw a    *
+ * frame every --capture-every ticks just for the capture and wait for a   *
+ * buffer instead.                                                         */
+
+#if !defined(CAPTURE_HH)
+#define CAPTURE_HH
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "bitmap.hh"
+#include "config.hh"
+#include "threads.hh"
+
+typedef struct capture {
+  bool on;
+  FILE* out;
+  bool piped;                // Is out a pipe to a command
+  bool y4m;                  // Y4M, or raw RGBA
+  int width, height;         // Of the window
+  int outWidth, outHeight;   // Of the video
+
+  handOff<std::vector<rgb32> > writer;
+
+  long frames;   // Frames shown so far
+  long written;  // Frames written to the video
+  long dropped;  // Frames dropped for want of a buffer
+} capture_t;
+
+capture_t recorder;
+
+// Shrink a frame by cfg.captureScale and write it out
+void writeFrame(int tick, std::vector<rgb32>& frame) {
+  int s = cfg.captureScale;
+  int w = recorder.outWidth;
+  int h = recorder.outHeight;
+  std::vector<uint8_t> bytes((size_t)w * h * (recorder.y4m ? 3 : 4));
+  size_t plane = (size_t)w * h;
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      // Average the pixels that make up this one
+      int r = 0, g = 0, b = 0;
+      for (int dy = 0; dy < s; dy++) {
+        rgb32* p = &frame[(size_t)(y * s + dy) * recorder.width + x * s];
+        for (int dx = 0; dx < s; dx++) {
+          r += p[dx].red;
+          g += p[dx].green;
+          b += p[dx].blue;
+        }
+      }
+      r /= s * s;
+      g /= s * s;
+      b /= s * s;
+
+      size_t i = (size_t)y * w + x;
+      if (recorder.y4m) {
+        // Full range BT.601, no chroma subsampling
+        bytes[i] = (uint8_t)(0.299 * r + 0.587 * g + 0.114 * b + 0.5);
+        bytes[plane + i] = (uint8_t)(128 - 0.168736 * r - 0.331264 * g + 0.5 * b + 0.5);
+        bytes[2 * plane + i] = (uint8_t)(128 + 0.5 * r - 0.418688 * g - 0.081312 * b + 0.5);
+      }
+      else {
+        bytes[4 * i] = r;
+        bytes[4 * i + 1] = g;
+        bytes[4 * i + 2] = b;
+        bytes[4 * i + 3] = 255; // Opaque, like the window
+      }
+    }
+  }
+
+  if (recorder.y4m) {
+    fputs("FRAME\n", recorder.out);
+  }
+  fwrite(&bytes[0], 1, bytes.size(), recorder.out);
+  ++recorder.written;
+}
+
+// Open the video, if one was asked for, and start writing it
+void startCapture(int width, int height) {
+  recorder.on = !cfg.capture.empty();
+  if (!recorder.on) {
+    return;
+  }
+  const std::string& path = cfg.capture;
+  recorder.piped = path[0] == '|';
+  recorder.out = recorder.piped ? popen(path.c_str() + 1, "w") : fopen(path.c_str(), "wb");
+  if (recorder.out == NULL) {
+    fprintf(stderr, "Failed to open %s for the capture\n", path.c_str());
+    exit(1);
+  }
+  recorder.y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+
+  recorder.width = width;
+  recorder.height = height;
+  recorder.outWidth = width / cfg.captureScale;
+  recorder.outHeight = height / cfg.captureScale;
+  if (recorder.y4m) {
+    fprintf(recorder.out, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+            recorder.outWidth, recorder.outHeight, cfg.fps, cfg.captureEvery);
+  }
+  else {
+    fprintf(stderr, "Capturing raw RGBA frames of %dx%d\n", recorder.outWidth, recorder.outHeight);
+  }
+
+  for (int i = 0; i < cfg.captureBuffers; i++) {
+    recorder.writer.spare.push_back(new std::vector<rgb32>((size_t)width * height));
+  }
+  recorder.frames = recorder.written = recorder.dropped = 0;
+  startHandOff(recorder.writer, writeFrame);
+}
+
+// Hand a frame to the writer. Without a spare buffer it is dropped, or
+// waits for one
+void handFrame(bitmap& bmp, bool wait) {
+  std::vector<rgb32>* frame = takeSpare(recorder.writer, wait);
+  if (frame == NULL) {
+    ++recorder.dropped;
+    return;
+  }
+  memcpy(&(*frame)[0], bmp.data(), bmp.size());
+  handOver(recorder.writer, 0, frame);
+}
+
+// Hand a shown frame to the writer, every cfg.captureEvery frames
+void captureFrame(bitmap& bmp) {
+  if (recorder.on && recorder.frames++ % cfg.captureEvery == 0) {
+    handFrame(bmp, false);
+  }
+}
+
+// Hand a frame drawn headless to the writer. Those are already drawn only
+// every cfg.captureEvery ticks, and there is no window to keep up with
+void captureTick(bitmap& bmp) {
+  if (recorder.on) {
+    handFrame(bmp, true);
+  }
+}
+
+// Write out the frames still waiting and close the video
+void stopCapture() {
+  if (!recorder.on) {
+    return;
+  }
+  stopHandOff(recorder.writer);
+  if (recorder.piped) {
+    pclose(recorder.out);
+  }
+  else {
+    fclose(recorder.out);
+  }
+  printf("Captured %ld frames to %s, dropped %ld\n", recorder.written, cfg.capture.c_str(), recorder.dropped);
+}
+
+#endif
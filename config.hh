@@ -0,0 +1,323 @@
+/* config.hh holds the settings of a run. Every setting has a default below *
+ * and can be changed from a config file or the command line, e.g.          *
+ *   ./evo --config=big.cfg --width=100000 --herbivores=1000000             *
+ * A config file has one "name = value" per line; '#' starts a comment.     */
+
+#if !defined(CONFIG_HH)
+#define CONFIG_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Defaults
+#define FPS 50
+// World size
+#define WIDTH 960
+#define HEIGHT 720
+#define NUM_CREATURES 40
+#define MAXTHREADS 8
+#define MAX_RADIUS 20 //Radius of creature with _size of 255
+#define MIN_RADIUS 6 //Radius of creature with _size of 0
+#define MAX_ENERGY 28 //Seconds creature will live with _energy of 255
+#define MIN_ENERGY 4 //Seconds creature will live with _energy of 0
+
+typedef struct config {
+  // World
+  int width = WIDTH;            // Width of the world in units
+  int height = HEIGHT;          // Height of the world in units
+  int fps = FPS;                // Simulation frames per second at normal speed
+  int paceSpin = 0;             // Microseconds before each frame's deadline to spin instead of sleeping
+  double dt = 1;                // Frames of simulated time per tick; collisions are swept, so larger steps don't tunnel
+
+  // Window, independent of the world size
+  int windowWidth = WIDTH;
+  int windowHeight = HEIGHT;
+
+  // Initial populations
+  int herbivores = NUM_CREATURES;
+  int carnivores = NUM_CREATURES / 10;
+
+  // Plants: each frame, rate rolls against 1.25*cos(2*pi*frames/period)+1.75
+  double plantPeriod = 10000;   // Frames per plant cycle
+  double plantMean = 1.75;      // Average plant generation
+  double plantAmplitude = 1.25; // How far plant generation swings
+  int plantRate = 1;            // Rolls per frame, scale this with the world area
+
+  // Food: "plants", or "field" for a grid of biomass growing as fast as the
+  // plants would, spreading and grazed where herbivores stand (see field.hh)
+  std::string food = "plants";
+  double cellSize = 16;         // Width and height of a field cell, about
+  double fieldCapacity = 4;     // Most plants' worth of biomass in a cell, up to 64
+  double fieldSpread = 0.05;    // Part of a cell spreading to each neighbour per tick, up to 0.25
+  double grazeRate = 0.05;      // Plants a herbivore grazes per frame
+
+  // Creature bounds
+  double minRadius = MIN_RADIUS;
+  double maxRadius = MAX_RADIUS;
+  double minEnergy = MIN_ENERGY;
+  double maxEnergy = MAX_ENERGY;
+
+  double skin = 40;             // How far past its sight a creature's neighbour list reaches
+  int sortPeriod = 20;          // Ticks between putting creatures and plants in Z-order, 0 never
+
+  // Creatures are drawn as crowds (see crowd.hh) where a 32x32 pixel tile
+  // holds more than this many per pixel, and everywhere when the biggest
+  // creature is smaller on screen than this radius in pixels
+  double crowdDensity = 0.05;
+  double crowdRadius = 1.5;
+
+  // Over this many milliseconds a tick, creatures plan where to go less often,
+  // in turns, and steer by their last plan in between. 0 plans every tick
+  double tickBudget = 0;
+  int maxPlanPeriod = 8;        // Most ticks a creature goes by one plan
+
+  // Record the window to FILE (Y4M if it ends in .y4m, raw RGBA otherwise),
+  // or to the input of a command for "|command" (see capture.hh)
+  std::string capture = "";
+  int captureEvery = 1;         // Frames shown per frame captured
+  int captureScale = 1;         // Window pixels along each side of a captured pixel
+  int captureBuffers = 8;       // Frames waiting to be written before more are dropped
+
+  // Log every birth and death to FILE, FILE.1, FILE.2... one for each
+  // process (see lineage.hh, and lineage.cc to read them)
+  std::string lineage = "";
+
+  // Record the run to FILE, or replay one recorded before, headless up to
+  // tick N (the end of the record for -1) and then in the window, or to
+  // dump the creatures at tick N and stop (see record.hh)
+  std::string record = "";
+  std::string replay = "";
+  int replayUntil = -1;
+  std::string replayDump = "";
+  int hashEvery = 100;          // Ticks between state hashes in a record, 0 for none
+
+  // Serve metrics to Prometheus on a localhost PORT, or a Unix socket at
+  // PATH (see metrics.hh)
+  std::string metrics = "";
+
+  // Stream the creatures of every tick to viewers on a localhost PORT, or a
+  // Unix socket at PATH (see stream.hh)
+  std::string stream = "";
+  int streamEvery = 1;          // Ticks per frame streamed
+  double streamQuantum = 0.125; // Positions are streamed rounded to this
+  int streamBuffers = 4;        // Frames waiting to be sent before ticks are skipped
+
+  // Write how many creatures of each diet have each value of each trait,
+  // with their means, variances and diversity, to FILE (see traits.hh)
+  std::string traits = "";
+  int traitsEvery = 10;         // Ticks between counts written
+
+  // Run M worlds at once, each in a process of its own, and move some of
+  // their creatures between them now and then (see islands.hh)
+  int islands = 1;
+  int migrateEvery = 500;       // Ticks between migrations, 0 for none
+  double migrateFraction = 0.01; // Of each island's creatures, moved each time
+  std::string topology = "ring"; // Where they go: the next island, or "random"
+
+  int threads = MAXTHREADS;     // Worker threads, in each process
+  int processes = 1;            // Processes sharing the world, each owning a stripe of it
+  int regionsX = 0;             // Columns of regions the world is split into, 0 picks
+  int regionsY = 0;             // Rows of regions the world is split into, 0 picks
+  unsigned seed = 0;            // Random seed, 0 picks one from the clock
+  std::string dataFile = "data8.txt";
+} config_t;
+
+// The settings of this run
+config_t cfg;
+
+// Set one setting by name. Returns false if there is no such setting
+bool setOption(const char* name, const char* value) {
+  if (!strcmp(name, "width")) cfg.width = atoi(value);
+  else if (!strcmp(name, "height")) cfg.height = atoi(value);
+  else if (!strcmp(name, "fps")) cfg.fps = atoi(value);
+  else if (!strcmp(name, "pace-spin")) cfg.paceSpin = atoi(value);
+  else if (!strcmp(name, "dt")) cfg.dt = atof(value);
+  else if (!strcmp(name, "window-width")) cfg.windowWidth = atoi(value);
+  else if (!strcmp(name, "window-height")) cfg.windowHeight = atoi(value);
+  else if (!strcmp(name, "herbivores")) cfg.herbivores = atoi(value);
+  else if (!strcmp(name, "carnivores")) cfg.carnivores = atoi(value);
+  else if (!strcmp(name, "plant-period")) cfg.plantPeriod = atof(value);
+  else if (!strcmp(name, "plant-mean")) cfg.plantMean = atof(value);
+  else if (!strcmp(name, "plant-amplitude")) cfg.plantAmplitude = atof(value);
+  else if (!strcmp(name, "plant-rate")) cfg.plantRate = atoi(value);
+  else if (!strcmp(name, "food")) cfg.food = value;
+  else if (!strcmp(name, "cell-size")) cfg.cellSize = atof(value);
+  else if (!strcmp(name, "field-capacity")) cfg.fieldCapacity = atof(value);
+  else if (!strcmp(name, "field-spread")) cfg.fieldSpread = atof(value);
+  else if (!strcmp(name, "graze-rate")) cfg.grazeRate = atof(value);
+  else if (!strcmp(name, "min-radius")) cfg.minRadius = atof(value);
+  else if (!strcmp(name, "max-radius")) cfg.maxRadius = atof(value);
+  else if (!strcmp(name, "min-energy")) cfg.minEnergy = atof(value);
+  else if (!strcmp(name, "max-energy")) cfg.maxEnergy = atof(value);
+  else if (!strcmp(name, "skin")) cfg.skin = atof(value);
+  else if (!strcmp(name, "sort-period")) cfg.sortPeriod = atoi(value);
+  else if (!strcmp(name, "crowd-density")) cfg.crowdDensity = atof(value);
+  else if (!strcmp(name, "crowd-radius")) cfg.crowdRadius = atof(value);
+  else if (!strcmp(name, "tick-budget")) cfg.tickBudget = atof(value);
+  else if (!strcmp(name, "max-plan-period")) cfg.maxPlanPeriod = atoi(value);
+  else if (!strcmp(name, "capture")) cfg.capture = value;
+  else if (!strcmp(name, "capture-every")) cfg.captureEvery = atoi(value);
+  else if (!strcmp(name, "capture-scale")) cfg.captureScale = atoi(value);
+  else if (!strcmp(name, "capture-buffers")) cfg.captureBuffers = atoi(value);
+  else if (!strcmp(name, "lineage")) cfg.lineage = value;
+  else if (!strcmp(name, "record")) cfg.record = value;
+  else if (!strcmp(name, "replay")) cfg.replay = value;
+  else if (!strcmp(name, "replay-until")) cfg.replayUntil = atoi(value);
+  else if (!strcmp(name, "replay-dump")) cfg.replayDump = value;
+  else if (!strcmp(name, "hash-every")) cfg.hashEvery = atoi(value);
+  else if (!strcmp(name, "metrics")) cfg.metrics = value;
+  else if (!strcmp(name, "stream")) cfg.stream = value;
+  else if (!strcmp(name, "stream-every")) cfg.streamEvery = atoi(value);
+  else if (!strcmp(name, "stream-quantum")) cfg.streamQuantum = atof(value);
+  else if (!strcmp(name, "stream-buffers")) cfg.streamBuffers = atoi(value);
+  else if (!strcmp(name, "traits")) cfg.traits = value;
+  else if (!strcmp(name, "traits-every")) cfg.traitsEvery = atoi(value);
+  else if (!strcmp(name, "islands")) cfg.islands = atoi(value);
+  else if (!strcmp(name, "migrate-every")) cfg.migrateEvery = atoi(value);
+  else if (!strcmp(name, "migrate-fraction")) cfg.migrateFraction = atof(value);
+  else if (!strcmp(name, "topology")) cfg.topology = value;
+  else if (!strcmp(name, "threads")) cfg.threads = atoi(value);
+  else if (!strcmp(name, "processes")) cfg.processes = atoi(value);
+  else if (!strcmp(name, "regions-x")) cfg.regionsX = atoi(value);
+  else if (!strcmp(name, "regions-y")) cfg.regionsY = atoi(value);
+  else if (!strcmp(name, "seed")) cfg.seed = strtoul(value, NULL, 10);
+  else if (!strcmp(name, "data")) cfg.dataFile = value;
+  else return false;
+  return true;
+}
+
+// Every setting given, as "name = value", in the order they were given
+std::vector<std::string> givenSettings;
+
+// Set one setting by name, and remember it was given
+bool giveOption(const char* name, const char* value) {
+  if (!setOption(name, value)) {
+    return false;
+  }
+  givenSettings.push_back(std::string(name) + " = " + value);
+  return true;
+}
+
+// Was a setting given, in a file or on the command line
+bool wasGiven(const std::string& name) {
+  for (size_t i = 0; i < givenSettings.size(); i++) {
+    if (givenSettings[i].compare(0, name.size() + 3, name + " = ") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Read "name = value" lines from a config file, up to the events of a record
+void readConfigFile(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to open config file %s\n", path);
+    exit(1);
+  }
+
+  char line[512];
+  int lineNum = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    ++lineNum;
+    // Drop comments and the newline
+    line[strcspn(line, "#\r\n")] = '\0';
+    if (!strcmp(line, "[events]")) {
+      break;
+    }
+
+    char name[128];
+    char value[384];
+    int n = sscanf(line, " %127[^= \t] = %383s", name, value);
+    if (n <= 0) {
+      continue; // Blank line
+    }
+    if (n != 2 || !giveOption(name, value)) {
+      fprintf(stderr, "%s:%d: bad setting '%s'\n", path, lineNum, line);
+      exit(1);
+    }
+  }
+  fclose(f);
+}
+
+// Read the settings from the command line, after any --config files it names
+// and, before those, the settings of a run it replays
+void readConfig(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--replay=", 9)) {
+      readConfigFile(argv[i] + 9);
+    }
+  }
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--config=", 9)) {
+      readConfigFile(argv[i] + 9);
+    }
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--config=", 9)) {
+      continue;
+    }
+    const char* eq = strchr(argv[i], '=');
+    if (strncmp(argv[i], "--", 2) || eq == NULL) {
+      fprintf(stderr, "Usage: %s [--config=FILE] [--name=value]...\n", argv[0]);
+      exit(1);
+    }
+    std::string name(argv[i] + 2, eq - argv[i] - 2);
+    if (!giveOption(name.c_str(), eq + 1)) {
+      fprintf(stderr, "Unknown setting '%s'\n", name.c_str());
+      exit(1);
+    }
+  }
+
+  // A replay writes its own data file, next to the record, not the recorded run's
+  if (!cfg.replay.empty() && !wasGiven("data")) {
+    cfg.dataFile = cfg.replay + ".data.csv";
+  }
+
+  if (cfg.width <= 2 * cfg.maxRadius || cfg.height <= 2 * cfg.maxRadius ||
+      cfg.fps <= 0 || !(cfg.dt > 0) || cfg.threads <= 0 || cfg.processes <= 0 || cfg.maxPlanPeriod <= 0 ||
+      cfg.windowWidth <= 0 || cfg.windowHeight <= 0) {
+    fprintf(stderr, "The world, window, fps, dt, thread and process counts and plan period must be positive\n");
+    exit(1);
+  }
+  if ((cfg.food != "plants" && cfg.food != "field") || !(cfg.cellSize > 0) ||
+      !(cfg.fieldCapacity >= 0 && cfg.fieldCapacity <= 64) ||
+      !(cfg.fieldSpread >= 0 && cfg.fieldSpread <= 0.25) || !(cfg.grazeRate >= 0)) {
+    fprintf(stderr, "Food is plants or field, with a positive cell size, capacity up to 64 and spread up to 0.25\n");
+    exit(1);
+  }
+  if (cfg.captureEvery <= 0 || cfg.captureBuffers <= 0 || cfg.captureScale <= 0 ||
+      cfg.captureScale > cfg.windowWidth || cfg.captureScale > cfg.windowHeight) {
+    fprintf(stderr, "Capture every, scale and buffers must be positive, and the scale no bigger than the window\n");
+    exit(1);
+  }
+  if (cfg.replayUntil < -1 || cfg.hashEvery < 0 || (!cfg.replayDump.empty() && cfg.replay.empty())) {
+    fprintf(stderr, "Replays run until a tick from 0, hashes are every 0 or more ticks, and dumps need a replay\n");
+    exit(1);
+  }
+  if (cfg.streamEvery <= 0 || !(cfg.streamQuantum > 0) || cfg.streamBuffers <= 0) {
+    fprintf(stderr, "Stream every, quantum and buffers must be positive\n");
+    exit(1);
+  }
+  if (cfg.traitsEvery <= 0 || cfg.paceSpin < 0) {
+    fprintf(stderr, "Traits every must be positive, and the pace spin 0 or more\n");
+    exit(1);
+  }
+  if (cfg.islands <= 0 || cfg.islands > 1024 || cfg.migrateEvery < 0 ||
+      !(cfg.migrateFraction >= 0 && cfg.migrateFraction <= 1) ||
+      (cfg.topology != "ring" && cfg.topology != "random")) {
+    fprintf(stderr, "Islands number 1 to 1024, migrate every 0 or more ticks a fraction from 0 to 1, "
+            "and the topology is ring or random\n");
+    exit(1);
+  }
+  if (cfg.islands > 1 && (cfg.processes > 1 || !cfg.record.empty() || !cfg.replay.empty())) {
+    fprintf(stderr, "Islands run one process each, and can't be recorded or replayed\n");
+    exit(1);
+  }
+}
+
+#endif
@@ -5,39 +5,73 @@
 #if !defined(CREATURE_HH)
 #define CREATURE_HH
 
-#define MAX_RADIUS 20 //Radius of creature with _size of 255
-#define MIN_RADIUS 6 //Radius of creature with _size of 0
-#define MAX_ENERGY 28 //Seconds creature will live with _energy of 255
-#define MIN_ENERGY 4 //Seconds creature will live with _energy of 0
-
-#define FPS 50
-// Screen size
-#define WIDTH 960
-#define HEIGHT 720
+// Food sources
+#define HERBIVORE 0
+#define CARNIVORE 1
+
+// Traits are packed into one genome, 8 bits each, in this order
+#define TRAIT_COLOR 0
+#define TRAIT_SIZE 1
+#define TRAIT_SPEED 2
+#define TRAIT_ENERGY 3
+#define TRAIT_VISION 4
+#define NUM_TRAITS 5
+#define GENOME_MASK 0xFFFFFFFFFFULL   // All five traits
+#define SPECIES_MASK 0xFFFFFFFF00ULL  // Every trait but color decides the species
+#define SPECIES_DISTANCE 8            // Creatures differing in this many bits can't reproduce
 
 #include <cmath>
 #include <ctime>
+#include <stdint.h>
 #include <pthread.h>
 #include <thread>
 
+#include "config.hh"
+#include "integrate.hh"
+#include "phenotype.hh"
+#include "random.hh"
+#include "storage.hh"
 #include "vec2d.hh"
 #include "threads.hh"
 
+// What a creature's last plan has it do until it plans again
+#define PLAN_STALE 0   // Nothing yet, or the plan is void: plan on the next tick
+#define PLAN_WANDER 1  // Saw nothing worth going for: keep going
+#define PLAN_FLEE 2    // Run in the target direction
+#define PLAN_SEEK 3    // Head for the target point
+
+// Everything about a creature that changes as it lives. The rest follows from
+// its genome, so this is all another process needs to make an exact copy
+typedef struct creatureState {
+  uint64_t id;
+  uint64_t genome;
+  vec2d pos;
+  vec2d vel;
+  double energy;
+  int food_source;
+  vec2d prevPos;
+  int status;
+  bool bouncing;
+  int plan;
+  vec2d target;
+  int planStatus;
+  double stepDone;
+} creatureState_t;
+
 // CREATURE CLASS
 class creature {
 public:
   // the lock for the creature
   pthread_mutex_t lock;
   
-  creature(int food_source, uint8_t color, uint8_t size,
-           uint8_t speed, uint8_t energy, uint8_t vision) : 
-    _food_source(food_source),
-    _size(size),
-    _speed(speed),
-    _energy(energy),
-    _vision(vision),
+  creature(int food_source, uint64_t genome) :
     _bouncing(false),
-    _color(color){
+    _plan(PLAN_STALE),
+    _planStatus(3),
+    _id(0),
+    _food_source(food_source),
+    _genome(genome & GENOME_MASK){
+    setPhenotype(); // setPos() needs the radius
     setPos();
     setVel();
     setMaxEnergy();
@@ -47,17 +81,16 @@ public:
     _status = 3;
   }
 
-  creature(int food_source, uint8_t color, uint8_t size,
-           uint8_t speed, uint8_t energy, uint8_t vision, vec2d pos, vec2d vel) : 
-    _food_source(food_source),
-    _size(size),
-    _speed(speed),
-    _energy(energy),
-    _vision(vision),
+  creature(int food_source, uint64_t genome, vec2d pos, vec2d vel) :
     _bouncing(false),
-    _color(color){
+    _plan(PLAN_STALE),
+    _planStatus(3),
+    _id(0),
+    _food_source(food_source),
+    _genome(genome & GENOME_MASK){
     setPos(pos);
     setVel(vel);
+    setPhenotype();
     setMaxEnergy();
     setMetabolism();
     _curr_energy = (double)_max_energy / 2;
@@ -65,28 +98,101 @@ public:
     _status = 3;
   }
 
+  // Copy a creature from its state, without touching the random numbers
+  creature(const creatureState_t& s) :
+    _food_source(s.food_source),
+    _genome(s.genome & GENOME_MASK){
+    setPhenotype();
+    setMaxEnergy();
+    setMetabolism();
+    setState(s);
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  creature(int food_source, uint8_t color, uint8_t size,
+           uint8_t speed, uint8_t energy, uint8_t vision) :
+    creature(food_source, packGenome(color, size, speed, energy, vision)) {}
+
+  creature(int food_source, uint8_t color, uint8_t size,
+           uint8_t speed, uint8_t energy, uint8_t vision, vec2d pos, vec2d vel) :
+    creature(food_source, packGenome(color, size, speed, energy, vision), pos, vel) {}
+
+  // Creatures can be packed together in memory, see storage.hh
+  static void* operator new(size_t size) { return allocateObject(size); }
+  static void operator delete(void* p) { releaseObject(p); }
+
+  // Pack five trait values into a genome
+  static uint64_t packGenome(uint8_t color, uint8_t size,
+                             uint8_t speed, uint8_t energy, uint8_t vision) {
+    return (uint64_t)color << (8 * TRAIT_COLOR) |
+      (uint64_t)size << (8 * TRAIT_SIZE) |
+      (uint64_t)speed << (8 * TRAIT_SPEED) |
+      (uint64_t)energy << (8 * TRAIT_ENERGY) |
+      (uint64_t)vision << (8 * TRAIT_VISION);
+  }
+
   //Debugging procedure
   void print(){
-    printf("food_source: %d\ncolor: %d\nsize: %d\nspeed: %d\nenergy: %d\nvision: %d\n\n", _food_source, _color, _size, _speed, _energy, _vision);
+    printf("food_source: %d\ncolor: %d\nsize: %d\nspeed: %d\nenergy: %d\nvision: %d\n\n", _food_source, getTrait(TRAIT_COLOR), getTrait(TRAIT_SIZE), getTrait(TRAIT_SPEED), getTrait(TRAIT_ENERGY), getTrait(TRAIT_VISION));
   }
   
+  // Get everything about this creature that changes as it lives
+  creatureState_t state() {
+    creatureState_t s;
+    s.id = _id;
+    s.genome = _genome;
+    s.pos = _pos;
+    s.vel = _vel;
+    s.prevPos = _prev_pos;
+    s.energy = _curr_energy;
+    s.food_source = _food_source;
+    s.status = _status;
+    s.bouncing = _bouncing;
+    s.plan = _plan;
+    s.target = _target;
+    s.planStatus = _planStatus;
+    s.stepDone = _stepDone;
+    return s;
+  }
+
+  // Catch up with another copy of this creature. The genome never changes
+  void setState(const creatureState_t& s) {
+    _id = s.id;
+    _pos = s.pos;
+    _vel = s.vel;
+    _prev_pos = s.prevPos;
+    _curr_energy = s.energy;
+    _status = s.status;
+    _bouncing = s.bouncing;
+    _plan = s.plan;
+    _target = s.target;
+    _planStatus = s.planStatus;
+    _stepDone = s.stepDone;
+  }
+
   // Get the position of this creature
   vec2d pos() { return _pos; }
   
+  // Get where this creature was before it last moved
+  vec2d prevPos() { return _prev_pos; }
+
   // Get the velocity of this creature
   vec2d vel() { return _vel; }
   
   // Get the color of this creature
-  rgb32 color() { return rgb32((int)_color, (int)_color, (int)_color); }
+  rgb32 color() {
+    uint8_t c = getTrait(TRAIT_COLOR);
+    return rgb32(c, c, c);
+  }
 
   // Get the food source of this creature
   int food_source() { return _food_source; }
   
   // Get the radius of this creature
-  double radius() { return ((double)_size / 255.0) * (MAX_RADIUS - MIN_RADIUS) + MIN_RADIUS; }
+  double radius() { return _radius; }
 
-  // Get the speed of this creature
-  double speed() { return ((double)_speed/ (2 * FPS)) * pow(((1 -((double)_size / 255)) * 1.5 + .5),1); }
+  // Get how far this creature moves in a tick
+  double speed() { return _speed; }
 
   // Get the current energy of this creature
   double curr_energy() { return (double)_curr_energy; }
@@ -95,56 +201,83 @@ public:
   double max_energy() { return (double)_max_energy; }
 
   // Get the vision of this creature
-  double vision() { return (double)_vision + radius(); }
+  double vision() { return _vision; }
 
   // Get a trait 
   uint8_t getTrait(int trait) {
-    switch(trait) {
-    case 0:
-      return _color; 
-      break;
-    case 1:
-      return _size;
-      break;
-    case 2:
-      return _speed;
-      break;
-    case 3:
-      return _energy;
-      break;
-    case 4:
-      return _vision;
-      break;
-    default:
+    if (trait < 0 || trait >= NUM_TRAITS) {
       return (uint8_t)-1;
-      break;
     }
+    return (uint8_t)(_genome >> (8 * trait));
   }
 
+  // Get the packed genome holding all traits
+  uint64_t genome() { return _genome; }
+
+  // Get or set the number this creature goes by in the lineage log
+  uint64_t id() { return _id; }
+  void setId(uint64_t id) { _id = id; }
+
   // Get the status
   int status() { return _status; }
 
   // Set the status
   void setStatus(int stat) { _status = stat; }
 
+  // Get what the last plan has this creature do, what it aims for, and the
+  // status it had then
+  int plan() { return _plan; }
+  vec2d target() { return _target; }
+  int planStatus() { return _planStatus; }
+
+  // Remember a plan until the next one, with the status that goes with it
+  void setPlan(int plan, vec2d target, int status) {
+    _plan = plan;
+    _target = target;
+    _planStatus = status;
+  }
+
+  // Get which of every period ticks this creature plans on. Creatures are
+  // spread over the ticks by their number, which any copy of them agrees on.
+  // Not by genome, as all the first creatures share one
+  int planPhase(int period) {
+    return (int)(((_id * 0x9E3779B97F4A7C15ULL) >> 32) % (unsigned)period);
+  }
+
   //Randomly sets the position of the creature within passed bounds
   void setPos(){
-    _pos = vec2d(rand() % (WIDTH - (int)ceil(2*radius())) + radius(), rand() % (HEIGHT - (int)ceil(2*radius())) + radius());
+    _pos = vec2d(simRand() % (cfg.width - (int)ceil(2*radius())) + radius(), simRand() % (cfg.height - (int)ceil(2*radius())) + radius());
+    _prev_pos = _pos;
   }
 
   //Sets the position to the given position
-  void setPos(vec2d pos) { _pos = pos; }
+  void setPos(vec2d pos) { _pos = pos; _prev_pos = pos; }
+
+  // Go back to where this creature was a fraction t through its last move
+  void rewind(double t) {
+    _pos = _prev_pos + (_pos - _prev_pos) * t;
+    _stepDone *= t;
+  }
+
+  // Go the rest of the step a meeting cut short, the way it bounced
+  void finishStep() {
+    _pos += _vel * (_speed * (1 - _stepDone));
+    _stepDone = 1;
+  }
 
   //Sets the velocity vector to a randomized normal vector
   void setVel(){
-    double dir = rand() * 2 * 3.141;
+    double dir = simRand() * 2 * 3.141;
     double x = cos(dir);
     double y = sin(dir);
     _vel = vec2d(x,y).normalized();
   }
 
-  //Sets the velocity vector to the normalized passed vector
-  void setVel(vec2d vel){ _vel = vel.normalized(); }
+  //Sets the velocity vector to the normalized passed vector. Without a
+  //direction, e.g. heading for where we already are, keep going as we were
+  void setVel(vec2d vel){
+    if(vel.x() != 0 || vel.y() != 0) _vel = unit(vel);
+  }
 
   // If a creature is bouncing off another
   bool bouncing(){ return _bouncing; }
@@ -152,34 +285,35 @@ public:
   // Set bouncing boolean
   void setBouncing(bool val){ _bouncing = val; }
 
+  //Looks up the radius, speed, vision and digestion of the creature's traits
+  void setPhenotype(){
+    uint8_t size = getTrait(TRAIT_SIZE);
+    _radius = FRACTION_TABLE[size] * (cfg.maxRadius - cfg.minRadius) + cfg.minRadius;
+    _speed = SPEED_TABLE[getTrait(TRAIT_SPEED)] * SIZE_SPEED_TABLE[size] / cfg.fps * cfg.dt;
+    _vision = (double)getTrait(TRAIT_VISION) + _radius;
+    _digest = DIGEST_TABLE[getTrait(TRAIT_ENERGY)];
+  }
+
   //Sets the maximum energy the creature can have
   void setMaxEnergy(){
-    _max_energy = (((double)_energy / 255.0) * (MAX_ENERGY - MIN_ENERGY) + MIN_ENERGY) * FPS;
+    double seconds = FRACTION_TABLE[getTrait(TRAIT_ENERGY)] * (cfg.maxEnergy - cfg.minEnergy) + cfg.minEnergy;
+    _max_energy = seconds * cfg.fps;
   }
 
   //Metabolism directly proportional to the trait values 
   void setMetabolism(){
-    _metabolism = pow(((double)(_vision + _size + _speed) / (255*3)) * 1.5 + .5, 1);
+    _metabolism = METABOLISM_TABLE[getTrait(TRAIT_VISION) + getTrait(TRAIT_SIZE) + getTrait(TRAIT_SPEED)] * cfg.dt;
   }
 
   // Increments current energy when food is eaten (inversely proportional to _energy)
   void incEnergy() {
-    _curr_energy = fmin(_max_energy, _curr_energy + FPS * ((1 - ((double)_energy / 255)) * 1.5 + .5));
+    _curr_energy = fmin(_max_energy, _curr_energy + cfg.fps * _digest);
   }
 
   // Increments current energy by specified amount
   void incEnergy(double add) {
     //printf("added: %f\n",add);
-    _curr_energy = fmin(_max_energy, _curr_energy + add * ((1 - ((double)_energy / 255)) * 1.5 + .5));
-  }
-
-  // Decrements energy as time passes
-  void decEnergy() {
-    _curr_energy -= _metabolism;
-
-    // Ensuring energy is never 0
-    if (_curr_energy <= 0)
-      _curr_energy = 0;
+    _curr_energy = fmin(_max_energy, _curr_energy + add * _digest);
   }
 
   // Used when reproducing, cuts curr_energy in half
@@ -191,29 +325,19 @@ public:
     return sqrt(pow((_pos.x() - cPos.x()), 2) + pow((_pos.y() - cPos.y()), 2));
   }
 
-  // Update the position of a creature
-  void update(){
-    if(_pos.y()-radius() < 0 && _vel.y() < 0){
-      setVel(vec2d(_vel.x(), -1*_vel.y()));
-    }
-    if(_pos.x()-radius() < 0 && _vel.x() < 0){
-      setVel(vec2d(-1*_vel.x(), _vel.y()));
-    }
-    if(_pos.y()+radius() > HEIGHT && _vel.y() > 0){
-      setVel(vec2d(_vel.x(), -1*_vel.y()));
-    }
-    if(_pos.x()+radius() > WIDTH && _vel.x() > 0){
-      setVel(vec2d(-1*_vel.x(), _vel.y()));
-    }
-    
-    _pos += (_vel * speed());
+  // Bounce off the walls, move and burn energy, in a world reaching from 0
+  // to walls. Returns true if the creature starved
+  bool move(v2d walls) {
+    _prev_pos = _pos;
+    _stepDone = 1;
+    return integrate(_pos, _vel, _speed, _radius, _curr_energy, _metabolism, walls);
   }
 
-  // Check if creatures are colliding
-  bool * checkCreatureCollision(creature * partner){
+  // Check if creatures are colliding. colStatus[0] is set if they reproduce,
+  // colStatus[1] if one eats the other
+  void checkCreatureCollision(creature * partner, bool * colStatus){
     vec2d partPos = (*partner).pos();
     vec2d partVel = (*partner).vel();
-    bool * colStatus = (bool*)malloc(sizeof(bool)*2);
 
     colStatus[0] = false;
     colStatus[1] = false;
@@ -247,7 +371,8 @@ public:
       }
 
       //https://nicoschertler.wordpress.com/2013/10/07/elastic-collision-of-circles-and-spheres/  
-      vec2d normal = vec2d(_pos.x() - partPos.x(), _pos.y() - partPos.y()).normalized();
+      vec2d normal = vec2d(_pos.x() - partPos.x(), _pos.y() - partPos.y());
+      normal = dist > 0 ? normal.normalized() : vec2d(1, 0); // Right on top of each other
 
       //Get dot products
       double c1dot = normal * _vel;
@@ -258,20 +383,30 @@ public:
       setVel(_vel - normal * p);
       (*partner).setVel(partVel + normal * p);
     }
-    return colStatus;
   }
 
   // Check is one creature can eat another
   bool canEat(creature * partner){
     bool res = false;
     if(_food_source == 1) {
-      if((double)_size*1.2 >= (double)partner->getTrait(1)) {
+      if((double)getTrait(TRAIT_SIZE)*1.2 >= (double)partner->getTrait(1)) {
         res = true;
       }
     }
     return res;
   }
 
+  // Check if creatures are similar enough to be the same species
+  bool sameSpecies(creature * partner){
+    uint64_t diff = (_genome ^ partner->genome()) & SPECIES_MASK;
+    return __builtin_popcountll(diff) < SPECIES_DISTANCE;
+  }
+
+  // Check if creature has the energy to reproduce
+  bool readyToMate(){
+    return (_curr_energy / _max_energy) >= 0.7;
+  }
+
   // Check if creatures vectors intersect
   bool intersects(creature * partner){
     vec2d partPos = (*partner).pos();
@@ -288,39 +423,76 @@ public:
   
   // Creatures fields
 private:  
-  double _mass;       // The mass of this creature
+  // Everything move() needs comes first, to sit together in memory
   vec2d _pos;         // The position of this creature
-  vec2d _prev_pos;    // The previous position of this creature
   vec2d _vel;         // The velocity of this creature
+  vec2d _prev_pos;    // Where this creature was before it last moved
+  double _speed;      // Distance moved each tick
+  double _radius;     // Radius of the creature
+  double _curr_energy;
+  double _metabolism; // Energy burnt each tick
+  bool _bouncing;
+  double _stepDone = 1; // Part of the last step taken, less when a meeting cut it short
+
+  double _mass;       // The mass of this creature
 
   int _status;         // 0: being chased; 1: finding a buddy; 2: finding food; 3: do nothing
 
-  bool _bouncing;
+  int _plan;           // PLAN_STALE, PLAN_WANDER, PLAN_FLEE or PLAN_SEEK
+  vec2d _target;       // Direction to flee in or point to head for
+  int _planStatus;     // Status while going by the plan
+
+  uint64_t _id;        // Unique, in order of birth, for the lineage log
 
   //Variables dependent on traits
   double _act_size;
-  double _curr_energy;
-  double _metabolism; // Metabolism of the creature
   double _max_energy; // Max energy of creature in terms of frames
+  double _vision;     // Distance the creature can see, from its center
+  double _digest;     // Energy gained per unit of food
 
   //Trait variables
   int _food_source;    // Herbivore (0) or carnivore (1)
-  uint8_t _color;       // Color of the creature
-  uint8_t _size;        // Size of the creature
-  uint8_t _speed;       // Speed of the creature
-  uint8_t _vision;      // Distance the creature can see
-  uint8_t _energy;      // Max energy of the creature
+  uint64_t _genome;    // Color, size, speed, energy and vision, 8 bits each
 
 }; // end of creature class
 
+// Create new genome from those of the parents
+uint64_t new_genome(creature* c, creature* d) {
+  // Each bit of the mask picks the parent that bit is inherited from
+  uint64_t mask = (uint64_t)simRand() << 31;
+  mask ^= (uint64_t)simRand();
+  uint64_t ret = (c->genome() & mask) | (d->genome() & ~mask);
+
+  // Every trait has a 25% chance of one bit being flipped.
+  // Each trait uses 5 bits of one random number: 2 for the chance, 3 for the bit
+  int mut = simRand();
+  for (int i = 0; i < NUM_TRAITS; i++) {
+    int bits = (mut >> (5 * i)) & 0x1F;
+    if ((bits & 0x3) == 0) {
+      ret ^= (uint64_t)1 << (8 * i + (bits >> 2));
+    }
+  }
+
+  return ret & GENOME_MASK;
+}
+
 // PLANT CLASS
 class plant {
 public:
   
-  plant() : _radius(2){
+  plant() : _radius(2), _eaten(false){
     setPos();
     pthread_mutex_init(&lock, NULL);
   }
+
+  // Copy a plant seen by another process
+  plant(vec2d pos, bool eaten) : _pos(pos), _radius(2), _eaten(eaten){
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  // Plants can be packed together in memory, see storage.hh
+  static void* operator new(size_t size) { return allocateObject(size); }
+  static void operator delete(void* p) { releaseObject(p); }
     
   // Get the position of this plant
   vec2d pos() { return _pos; }
@@ -328,16 +500,16 @@ public:
   // Get the radius of the plant
   double radius(){ return _radius; }
 
-  // Check the plant is colliding with a creature
+  // Has a creature eaten this plant
+  bool eaten(){ return _eaten; }
+
+  // Mark the plant as eaten, it is removed at the end of the frame
+  void setEaten(){ _eaten = true; }
+
+  // Check the plant touched a creature anywhere along its last step
   bool checkCreatureCollision(creature * c){
-    vec2d cPos = (*c).pos();
-    
-    double dist = sqrt(pow((_pos.x() - cPos.x()), 2) + pow((_pos.y() - cPos.y()), 2));
-    //If a collision has occured
-    if(dist <= radius() + (*c).radius()){
-      return true;
-    }
-    return false;
+    vec2d step = c->pos() - c->prevPos();
+    return timeOfImpact(_pos - c->prevPos(), -step, radius() + c->radius()) >= 0;
   }
 
   // Check the distance from a creature
@@ -348,7 +520,7 @@ public:
 
   // Set the position of hte plant
   void setPos(){
-    _pos = vec2d(rand() % (WIDTH - (int)ceil(2*_radius)) + _radius, rand() % (HEIGHT - (int)ceil(2*_radius)) + _radius);
+    _pos = vec2d(simRand() % (cfg.width - (int)ceil(2*_radius)) + _radius, simRand() % (cfg.height - (int)ceil(2*_radius)) + _radius);
   }
   
   //Plant fields
@@ -357,6 +529,7 @@ private:
   
   vec2d _pos;
   double _radius;
+  bool _eaten;
 }; // end of plant class
 
 #endif
@@ -0,0 +1,159 @@
+/* crowd.hh draws creatures where there are too many of them, or they are   *
+ * too small on screen, to draw one by one. Each is added to the window     *
+ * pixel under its centre instead: how many herbivores and carnivores are   *
+ * on the pixel and the sum of their colour traits. One pass, split among   *
+ * the threads, turns the sums into colours, on a logarithmic ramp so thin  *
+ * crowds and thick ones both show. Tiles of the window with few, big       *
+ * enough creatures on them still get a circle for each creature.           */
+
+#if !defined(CROWD_HH)
+#define CROWD_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "bitmap.hh"
+#include "config.hh"
+#include "creature.hh"
+#include "threads.hh"
+#include "view.hh"
+
+#define CROWD_TILE 32  // Window pixels along each side of a tile; one task colours a row of tiles
+#define CROWD_RAMP 6   // Crowds of 2^CROWD_RAMP creatures or more are at full brightness
+
+// The creatures on one window pixel
+typedef struct crowdPixel {
+  uint32_t diet[2]; // Herbivores and carnivores
+  uint32_t color;   // Sum of their colour traits
+} crowdPixel_t;
+
+typedef struct crowd {
+  std::vector<crowdPixel_t> pixels; // Every pixel of the window, row by row
+  std::vector<uint8_t> tiles;       // Is each tile crowded
+  int width, height;                // Of the window
+  int tileCols, tileRows;
+  int y0, y1;                       // Rows of the window this process draws
+  bool everywhere;                  // Are creatures too small to draw one by one anywhere
+  bitmap* bmp;                      // What is being drawn on
+  double ramp[(1 << CROWD_RAMP) + 1]; // Brightness of a crowd of each size
+
+  // The pixel under each creature of each region, or -1 if we don't draw it,
+  // so those drawn one by one are found without going over everyone again
+  std::vector<std::vector<long> > under;
+} crowd_t;
+
+crowd_t crowds;
+
+// Size the sums to the window and the world's regions
+void initCrowds(int width, int height, int regions) {
+  crowds.width = width;
+  crowds.height = height;
+  crowds.tileCols = (width + CROWD_TILE - 1) / CROWD_TILE;
+  crowds.tileRows = (height + CROWD_TILE - 1) / CROWD_TILE;
+  crowds.pixels.assign((size_t)width * height, crowdPixel_t());
+  crowds.tiles.assign(crowds.tileCols * crowds.tileRows, 0);
+  crowds.under.resize(regions);
+  for (int n = 0; n <= 1 << CROWD_RAMP; n++) {
+    crowds.ramp[n] = 255 * log2(1.0 + n) / log2(1.0 + (1 << CROWD_RAMP));
+  }
+}
+
+// Start a frame drawing on a band of window rows, from y0 up to y1
+void clearCrowds(bitmap* bmp, int y0, int y1) {
+  crowds.bmp = bmp;
+  crowds.y0 = y0;
+  crowds.y1 = y1;
+  crowds.everywhere = cfg.maxRadius * view.scale < cfg.crowdRadius;
+  if (y0 < y1) {
+    memset(&crowds.pixels[(size_t)y0 * crowds.width], 0,
+           (size_t)(y1 - y0) * crowds.width * sizeof(crowdPixel_t));
+  }
+}
+
+// Get the pixel under a creature, or -1 if it isn't one we draw
+long crowdPixelOf(creature* c) {
+  int x = (int)floor((c->pos().x() - view.x) * view.scale);
+  int y = (int)floor((c->pos().y() - view.y) * view.scale);
+  if (x < 0 || x >= crowds.width || y < crowds.y0 || y >= crowds.y1) {
+    return -1;
+  }
+  return (long)y * crowds.width + x;
+}
+
+// Get the tile a pixel is on
+int crowdTileOf(long pixel) {
+  int x = pixel % crowds.width;
+  int y = pixel / crowds.width;
+  return y / CROWD_TILE * crowds.tileCols + x / CROWD_TILE;
+}
+
+// Start adding the creatures of a region, none of them drawn yet
+void startCrowd(int r, size_t creatures) {
+  crowds.under[r].assign(creatures, -1);
+}
+
+// Add the creature at some index of a region to the pixel under it.
+// Creatures of several regions may share a pixel, so the adding is atomic
+void addToCrowd(int r, int i, creature* c) {
+  long p = crowdPixelOf(c);
+  crowds.under[r][i] = p;
+  if (p < 0) {
+    return;
+  }
+  crowdPixel_t& px = crowds.pixels[p];
+  __atomic_fetch_add(&px.diet[c->food_source()], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&px.color, c->getTrait(TRAIT_COLOR), __ATOMIC_RELAXED);
+}
+
+// Colour one row of tiles on our rows from the sums, where the tiles are
+// crowded: green for herbivores and red for carnivores, brighter for bigger
+// crowds and lighter colour traits
+void colorCrowdBand(int band) {
+  int first = std::max(crowds.y0, band * CROWD_TILE);
+  int last = std::min((band + 1) * CROWD_TILE, crowds.y1);
+  double limit = cfg.crowdDensity * CROWD_TILE * CROWD_TILE;
+
+  // Count the creatures on each tile
+  std::vector<uint32_t> counts(crowds.tileCols, 0);
+  for (int y = first; y < last; y++) {
+    crowdPixel_t* row = &crowds.pixels[(size_t)y * crowds.width];
+    for (int x = 0; x < crowds.width; x++) {
+      counts[x / CROWD_TILE] += row[x].diet[HERBIVORE] + row[x].diet[CARNIVORE];
+    }
+  }
+  for (int t = 0; t < crowds.tileCols; t++) {
+    crowds.tiles[band * crowds.tileCols + t] = crowds.everywhere || counts[t] > limit;
+  }
+
+  for (int y = first; y < last; y++) {
+    crowdPixel_t* row = &crowds.pixels[(size_t)y * crowds.width];
+    for (int x = 0; x < crowds.width; x++) {
+      uint32_t n = row[x].diet[HERBIVORE] + row[x].diet[CARNIVORE];
+      if (n == 0 || !crowds.tiles[band * crowds.tileCols + x / CROWD_TILE]) {
+        continue;
+      }
+      double shade = crowds.ramp[std::min<uint32_t>(n, 1 << CROWD_RAMP)] * (0.5 + row[x].color / (510.0 * n));
+      crowds.bmp->set(x, y, rgb32(shade * row[x].diet[CARNIVORE] / n, shade * row[x].diet[HERBIVORE] / n, 0));
+    }
+  }
+}
+
+// Colour all of our rows where the tiles are crowded
+void colorCrowds() {
+  if (crowds.y0 < crowds.y1) {
+    runTasks(&colorCrowdBand, crowds.y0 / CROWD_TILE, (crowds.y1 - 1) / CROWD_TILE + 1);
+  }
+}
+
+// Should the creature at some index of a region be drawn as a circle: it is
+// in a tile with few others, or off our rows while creatures are big enough,
+// for the bitmap to clip
+bool drawnAlone(int r, int i) {
+  long p = crowds.under[r][i];
+  return p < 0 ? !crowds.everywhere : !crowds.tiles[crowdTileOf(p)];
+}
+
+#endif
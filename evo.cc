@@ -11,12 +11,32 @@
 #include <cmath>
 #include <fstream>
 
+#include "capture.hh"
+#include "config.hh"
 #include "creature.hh"
+#include "crowd.hh"
+#include "field.hh"
+#include "grid.hh"
 #include "gui.hh"
+#include "histogram.hh"
+#include "islands.hh"
+#include "lineage.hh"
+#include "metrics.hh"
+#include "mates.hh"
+#include "neighbours.hh"
+#include "pacing.hh"
+#include "random.hh"
+#include "record.hh"
+#include "shard.hh"
+#include "stream.hh"
+#include "traits.hh"
+#include "view.hh"
+#include "world.hh"
 
 using namespace std;
 
-#define NUM_CREATURES 40
+#define MAX_SPEEDUP 1024 // Most simulation ticks run per displayed frame
+#define PLAN_ADAPT_FRAMES 10 // Frames between changes to the plan period
 
 // Update all creatures in the simulation
 void updateCreatures();
@@ -25,35 +45,82 @@ void updateCreatures();
 void drawCreature(bitmap* bmp, creature * c);
 // Draw a random plant for eating
 void drawPlant(bitmap* bmp, plant * p);
+// Draw the food field over this process's stripe of the window
+void drawField(bitmap* bmp);
+// Can anything of a region be in view
+bool regionInView(region_t& reg);
+// Get the rows of the window showing this process's stripe
+void stripeRows(bitmap* bmp, int* y0, int* y1);
+// Sort a region's creatures and plants into its draw grids, if the edge of
+// the view cuts through it
+void cullRegion(int r);
+// Call f(i) for each of a region's creatures or plants that can be in view
+template<typename T, typename F>
+void eachInView(region_t& reg, std::vector<T*>& items, spatialGrid<T>& grid, F f);
+// Add a region's creatures in view to the crowds
+void crowdRegion(int r);
 
 // Initialize creatures in the simulation
 void initCreatures();
 
-// Perform the functions needed on each creature each frame
-void handleTick(int i);
+// Phases of a frame, each run on every region at once
+void findBorders(int r);
+void gatherGhosts(int r);
+void perceiveRegion(int r);
+void reactRegion(int r);
+void moveRegion(int r);
+void collideRegion(int r);
+void wantGrassRegion(int r);
+void grazeRegion(int r);
+void sortRegion(int r);
+void migrateRegion(int r);
+void receiveRegion(int r);
+void reorderRegion(int r);
 
-// Find the nearest food source and change velocity vector
-void findNearestFood(creature * c);
+// Check the collisions that cross a region's edges
+void collideBorders(int r);
 
-// Find the nearest herbivore to eat and change velocity vectors
-void findNearestHerbivore(creature* c);
-// If you are an herbivore, run away from carnivores near you
-void runAway(creature* c);
+// Make the babies of everyone in a region who met a buddy
+void mateRegion(int r);
 
-// Find a buddy for reproduction
-void findNearestBuddy(creature* c);
+// Did two creatures touch during their last steps
+bool meet(creature* c, creature* d);
+
+// Handle two creatures that touch
+void collide(region_t& reg, creature* c, creature* d);
+
+// Every creature of one diet in a region looks around
+template<int Diet> void perceiveDiet(region_t& reg);
+
+// Find threats, buddies and food in a single pass over the neighbours
+template<int Diet> void perceive(region_t& reg, int i, perception_t* p);
+
+// Change velocity vector and status based on what was perceived
+void react(creature* c, perception_t* p);
+
+// Get where to head for to catch another creature
+vec2d leadTarget(creature* c, creature* d);
+
+// Does a creature plan where to go this tick
+bool plansNow(creature* c);
+
+// Keep going by the last plan
+void steer(creature* c);
 
 // Reproduce
 void reproduce(creature* c, creature* d);
 
-// Create new trait for reproduction
-uint8_t new_trait(creature* c, creature* d, int trait);
-
 // check if the creatures are similar enough to reproduce
 bool reproductionSimilarity(creature* c, creature* d);
 
-//Get elapsed time in miliseconds
-unsigned GetTickCount();
+//Get elapsed time in miliseconds, with sub-millisecond precision
+double GetTimeMs();
+
+// Advance the simulation by one frame, including telemetry
+void simulateTick();
+
+// Handle window events. Returns false when the user closes the window
+bool handleEvents();
 
 //Write data into the file for the performance of creatures.
 void writeData();
@@ -62,143 +129,461 @@ void writeData();
 void generatePlants();
 
 
-// List of creatures
-vector<creature*> creatures;
-vector<plant*> plants;
-
 int frames = 0;
 
+// Plant rolls owed for the fractions of a roll per tick so far
+double plantRolls = 0;
+
 double thisTime;
 
-const char* fName = "data8.txt";
+// Simulation ticks the user asked for per displayed frame
+int speedup = 1;
+
+// Ticks between a creature's plans, raised while ticks go over the budget
+int planPeriod = 1;
+
+// How long ticks take, shown when the simulation ends
+histogram_t tickTimes;
+
+// Totals over the creatures and plants of one process, for the data file
+typedef struct telemetry {
+  long plants;
+  long herbivores;
+  long carnivores;
+  long size;
+  long speed;
+  long energy;
+  long vision;
+} telemetry_t;
 
 int main(int argc, char** argv) {
-  // Seed the random number generator
-  srand(time(NULL));
-  
-  // Create a GUI window
-  gui ui("Evolution Simulation", WIDTH, HEIGHT);
-  
-  // Start with the running flag set to true
-  bool running = true;
+  readConfig(argc, argv);
+
+  // Seed the random number generator, keeping the seed for a record
+  if (cfg.seed == 0) {
+    cfg.seed = time(NULL);
+  }
+  seedRandom(cfg.seed);
+  loadReplay();
+  startIslands();
   
-  // Render everything using this bitmap
-  bitmap bmp(WIDTH, HEIGHT);
+  // Show the whole world in the window
+  view = wholeWorld();
 
   ofstream file;
-  file.open(fName, ios::trunc); //Clear File
+  file.open(cfg.dataFile.c_str(), ios::trunc); //Clear File
   file << "Plant Generation,Plants,Herbivores,Carnivores,ProcessSpeed,Size,Speed,Energy,Vision\n";
   file.close();
 
+  initWorld();
   initCreatures();
+
+  // Split the world between the processes, which all draw into one shared
+  // bitmap, and mark its tiles in one shared set of flags
+  size_t pixelBytes = cfg.windowWidth * cfg.windowHeight * sizeof(rgb32);
+  startShards(cfg.processes, pixelBytes + bitmap::tileBytes(cfg.windowWidth, cfg.windowHeight));
+  setStripe(shardRank, shardCount);
+  initField(shardRank, shardCount);
+
+  // Each process logs the first creatures of its own stripe
+  startLineage(shardRank, regions.size());
+  for (int r = firstRegion; r < lastRegion; r++) {
+    for (int i = 0; i < regions[r].creatures.size(); i++) {
+      creature* c = regions[r].creatures[i];
+      logBirth(c->id(), 0, 0, 0, c->food_source(), c->genome());
+    }
+  }
+
+  initPeers();
   initTaskQueue();
+  bitmap bmp(cfg.windowWidth, cfg.windowHeight, (rgb32*)sharedPixels, (uint8_t*)sharedPixels + pixelBytes);
+  initCrowds(cfg.windowWidth, cfg.windowHeight, regions.size());
+  startStream();
+  startTraits();
+
+  // Only the first process of the first island has a window, but every
+  // island can capture what it would show
+  gui* ui = NULL;
+  if (shardRank == 0) {
+    startCapture(cfg.windowWidth, cfg.windowHeight);
+  }
+  if (shardRank == 0 && islandRank == 0) {
+    ui = new gui("Evolution Simulation", cfg.windowWidth, cfg.windowHeight);
+    startRecord();
+    startMetrics();
+  }
 
-  unsigned int next_tick;
-  while(running) {
-    next_tick = GetTickCount();
+  // Ticks actually run per frame, lowered when they don't fit in a frame
+  int ticksPerFrame = 1;
+  // Running averages of how long one tick and one render take
+  double tickMs = 0;
+  double renderMs = 0;
+  // Frames, ticks and time since the plan period last changed
+  int adaptFrames = 0;
+  int adaptTicks = 0;
+  double adaptMs = 0;
+  // Ticks counted towards the ticks/sec shown in the title
+  int ticksThisSecond = 0;
+  double secondStart = GetTimeMs();
+
+  startPacing();
+  while(true) {
+    if (shardRank == 0 && islandRank > 0) {
+      // Other islands run headless, a frame to each migration, never
+      // ahead of the first, and stop at the tick it stopped at
+      int ticks = islandTicks(frames);
+      control->running = ticks > 0;
+      control->headless = true;
+      control->ticks = std::min(ticks, MAX_SPEEDUP);
+      control->planPeriod = planPeriod;
+    }
+    else if (shardRank == 0) {
+      control->running = handleEvents() && !tapeDone(frames);
+      control->ticks = ticksPerFrame;
+      control->planPeriod = planPeriod;
+
+      // A replay runs headless, as fast as it can, up to where it was asked
+      // to. Frames end at every hash, to stop as soon as one doesn't match
+      control->headless = headlessAt(frames);
+      if (control->headless) {
+        int ticks = cfg.hashEvery > 0 ? cfg.hashEvery - frames % cfg.hashEvery : MAX_SPEEDUP;
+        control->ticks = std::min(tape.until - frames, std::min(ticks, MAX_SPEEDUP));
+      }
+    }
+    if (shardRank == 0) {
+      // Headless frames are only drawn to be captured, every
+      // cfg.captureEvery ticks, so while capturing they end at each capture
+      if (control->headless && recorder.on) {
+        control->ticks = std::min(control->ticks, cfg.captureEvery - frames % cfg.captureEvery);
+      }
+      control->drawn = !control->headless ||
+        (recorder.on && (frames + control->ticks) % cfg.captureEvery == 0);
 
-    // Update creature positions
-    updateCreatures();
+      // Darken the bitmap instead of clearing it to leave trails, unless
+      // the view moved and the trails would be in the wrong place
+      if (control->drawn) {
+        bmp.darken(sameView(view, control->view) ? 0.60 : 0);
+      }
+      control->view = view;
+    }
 
-    // Darken the bitmap instead of clearing it to leave trails
-    bmp.darken(0.60);
+    // Everyone starts the frame with the first process's orders
+    shardBarrier();
+    if (!control->running) {
+      break;
+    }
+    planPeriod = control->planPeriod;
+    view = control->view;
+
+    // Run as many simulation ticks as we asked for and have time for
+    double simStart = GetTimeMs();
+    double tickStart = simStart;
+    for (int k = 0; k < control->ticks; k++) {
+      simulateTick();
+      double tickEnd = GetTimeMs();
+      record(tickTimes, tickEnd - tickStart);
+      tickStart = tickEnd;
+    }
+    double simEnd = tickStart;
+    tickMs = 0.9 * tickMs + 0.1 * (simEnd - simStart) / control->ticks;
+    ticksThisSecond += control->ticks;
+
+    if (!control->drawn) {
+      skipPacing();
+      shardBarrier();
+      continue;
+    }
 
-    generatePlants();
-    
-    //Draw plants
-    for (int i = 0; i < plants.size(); ++i){
-      drawPlant(&bmp, plants[i]);
+    //Draw plants, in the regions in view and, where the view's edge cuts a
+    //region, only those in the grid cells in view
+    runTasks(&cullRegion, firstRegion, lastRegion);
+    if (grass.on) {
+      drawField(&bmp);
+    }
+    for (int r = firstRegion; r < lastRegion; ++r){
+      region_t& reg = regions[r];
+      if (!regionInView(reg)) {
+        continue;
+      }
+      eachInView(reg, reg.plants, reg.drawPlantGrid, [&](int i) {
+        drawPlant(&bmp, reg.plants[i]);
+      });
     }
 
-    // Draw creatures
-    for (int i = 0; i < creatures.size(); i++) {
-      drawCreature(&bmp, creatures[i]);
-      creatures[i]->setStatus(3);
+    // Draw creatures in the regions in view: crowds all at once, then the
+    // creatures with few others around one by one
+    int stripeY0, stripeY1;
+    stripeRows(&bmp, &stripeY0, &stripeY1);
+    clearCrowds(&bmp, stripeY0, stripeY1);
+    runTasks(&crowdRegion, firstRegion, lastRegion);
+    colorCrowds();
+    for (int r = firstRegion; r < lastRegion && !crowds.everywhere; ++r){
+      region_t& reg = regions[r];
+      if (!regionInView(reg)) {
+        continue;
+      }
+      eachInView(reg, reg.creatures, reg.drawGrid, [&](int i) {
+        if (drawnAlone(r, i)) {
+          drawCreature(&bmp, reg.creatures[i]);
+        }
+      });
     }
 
-    if(frames % 10 == 0){
-      writeData();
+    // Wait for every stripe to be drawn
+    shardBarrier();
+    if (shardRank != 0) {
+      continue;
     }
-	
-    // Display the rendered frame
-    ui.display(bmp);
-    ++frames;
-    
-    unsigned int cur_time = GetTickCount();
-    unsigned int diff = cur_time - next_tick;
-    
-    if(diff < 1000/FPS){
-      usleep((1000/FPS - diff) * 1000);
+
+    // A headless frame drawn for the capture is only recorded
+    if (control->headless) {
+      captureTick(bmp);
+      skipPacing();
+      continue;
+    }
+
+    // Display the rendered frame, and record it
+    ui->display(bmp);
+    captureFrame(bmp);
+    renderMs = 0.9 * renderMs + 0.1 * (GetTimeMs() - simEnd);
+
+    // Fit as many ticks as possible in what is left of the frame budget
+    double spare = 1000.0 / cfg.fps - renderMs;
+    ticksPerFrame = tickMs > 0 ? (int)(spare / tickMs) : speedup;
+    if (ticksPerFrame > speedup) ticksPerFrame = speedup;
+    if (ticksPerFrame < 1) ticksPerFrame = 1;
+
+    // Plan less often while ticks go over the budget, and more often again
+    // once they are well under it. Changes wait until the last one shows
+    adaptTicks += control->ticks;
+    adaptMs += simEnd - simStart;
+    if (++adaptFrames == PLAN_ADAPT_FRAMES) {
+      double ms = adaptMs / adaptTicks;
+      if (cfg.tickBudget > 0 && ms > cfg.tickBudget && planPeriod < cfg.maxPlanPeriod) {
+        ++planPeriod;
+      }
+      else if (ms < 0.5 * cfg.tickBudget && planPeriod > 1) {
+        --planPeriod;
+      }
+      adaptFrames = adaptTicks = 0;
+      adaptMs = 0;
     }
+
+    // Show the effective simulation speed once a second
+    if (simEnd - secondStart >= 1000) {
+      char title[128];
+      snprintf(title, sizeof(title), "Evolution Simulation - %dx - %.0f ticks/sec - plans every %d",
+               speedup, ticksThisSecond * 1000.0 / (simEnd - secondStart), planPeriod);
+      ui->setTitle(title);
+      ticksThisSecond = 0;
+      secondStart = simEnd;
+    }
+
+    // Wait for the frame's deadline
+    paceFrame();
   }
-  
-  return 0;
+
+  stopTaskQueue();
+  stopLineage();
+  stopTraits();
+  if (tape.on && !cfg.replayDump.empty() && frames == tape.until) {
+    dumpCreatures(frames);
+  }
+  stopRecord();
+  stopIslands(frames);
+  if (shardRank == 0) {
+    stopShards();
+    stopCapture();
+    stopMetrics();
+    stopStream();
+    delete ui;
+  }
+  if (shardRank == 0 && islandRank == 0) {
+    printHistogram(tickTimes, stdout, "Tick times");
+    if (cfg.tickBudget > 0) {
+      printf("%.1f%% of ticks within the %g ms budget\n",
+             100 * fractionUnder(tickTimes, cfg.tickBudget), cfg.tickBudget);
+    }
+    printPacing();
+  }
+  return tape.diverged ? 1 : 0;
+}
+
+// Advance the simulation by one frame
+void simulateTick() {
+  // Plan as often as a replayed run did, or note how often for a record
+  tapeTick(frames, &planPeriod);
+
+  // Update creature positions
+  startPhases();
+  updateCreatures();
+
+  generatePlants();
+  phaseDone(PHASE_PLANTS);
+
+  // Telemetry follows simulation frames, however many are displayed
+  if(frames % 10 == 0){
+    writeData();
+  }
+  writeTraits(frames);
+  ++frames;
+  migrateIslands(frames);
+  checkTick(frames);
+  streamTick(frames);
+}
+
+// Handle window events: closing the window, +/- to change the speed, and moving the view
+bool handleEvents() {
+  // Where the mouse is, for zooming around it
+  static int mouseX = 0;
+  static int mouseY = 0;
+
+  SDL_Event event;
+  while (SDL_PollEvent(&event)) {
+    if (event.type == SDL_QUIT) {
+      return false;
+    }
+    if (event.type == SDL_MOUSEMOTION) {
+      mouseX = event.motion.x;
+      mouseY = event.motion.y;
+      if (event.motion.state & SDL_BUTTON_LMASK) { // Drag the world along
+        panView(view, -event.motion.xrel, -event.motion.yrel);
+      }
+    }
+    if (event.type == SDL_MOUSEWHEEL && event.wheel.y != 0) {
+      zoomView(view, event.wheel.y > 0 ? ZOOM_STEP : 1 / ZOOM_STEP, mouseX, mouseY);
+    }
+    if (event.type == SDL_KEYDOWN) {
+      switch (event.key.keysym.sym) {
+      case SDLK_EQUALS:
+      case SDLK_PLUS:
+      case SDLK_KP_PLUS:
+        if (speedup < MAX_SPEEDUP) speedup *= 2;
+        break;
+      case SDLK_MINUS:
+      case SDLK_KP_MINUS:
+        if (speedup > 1) speedup /= 2;
+        break;
+      case SDLK_LEFT:
+        panView(view, -PAN_PIXELS, 0);
+        break;
+      case SDLK_RIGHT:
+        panView(view, PAN_PIXELS, 0);
+        break;
+      case SDLK_UP:
+        panView(view, 0, -PAN_PIXELS);
+        break;
+      case SDLK_DOWN:
+        panView(view, 0, PAN_PIXELS);
+        break;
+      case SDLK_PAGEUP:
+        zoomView(view, ZOOM_STEP, mouseX, mouseY);
+        break;
+      case SDLK_PAGEDOWN:
+        zoomView(view, 1 / ZOOM_STEP, mouseX, mouseY);
+        break;
+      case SDLK_HOME:
+        view = wholeWorld();
+        break;
+      case SDLK_ESCAPE:
+        return false;
+      }
+    }
+  }
+  return true;
 }
 
 //Plant generation
 void generatePlants(){
-  double rawPlants = 1.25*cos(2*3.1415*frames/10000)+1.75;
+  double rawPlants = cfg.plantAmplitude*cos(2*3.1415*frames*cfg.dt/cfg.plantPeriod)+cfg.plantMean;
+
+  // A field grows as many plants as the rolls would make on average
+  if (grass.on) {
+    growField(cfg.plantRate * fmin(fmax(rawPlants, 0), 3));
+    if (shardCount > 1) sendField();
+    spreadField();
+    return;
+  }
 
   int f1 = rawPlants * 1000;
   int f2 = (rawPlants - 1) * 1000;
   int f3 = (rawPlants - 2) * 1000;
 
-  double prob = rand() % 1000;
+  // Rolls are per frame of simulated time
+  plantRolls += cfg.plantRate * cfg.dt;
+  int rolls = (int)plantRolls;
+  plantRolls -= rolls;
+
+  for (int r = 0; r < rolls; r++) {
+    double prob = simRand() % 1000;
   
-  if(f1 >= prob){
-    plant * newPlant = new plant();
-    plants.push_back(newPlant);
-  }
-  if(f2 >= prob){
-    plant * newPlant = new plant();
-    plants.push_back(newPlant);
-  }
-  if(f3 >= prob){
-    plant * newPlant = new plant();
-    plants.push_back(newPlant);
+    if(f1 >= prob){
+      addPlant(new plant());
+    }
+    if(f2 >= prob){
+      addPlant(new plant());
+    }
+    if(f3 >= prob){
+      addPlant(new plant());
+    }
   }
 }
 
 //Write data into the file for the performance of creatures.
+//Every process adds up its own stripe and the first one writes the totals
 void writeData(){
-  int carn = 0;
-  int herb = 0;
-
-  int size = 0;
-  int speed = 0;
-  int energy = 0;
-  int vision = 0;
+  telemetry_t sums = {0, 0, 0, 0, 0, 0, 0};
+  sums.plants = grass.on ? fieldMass() : numPlants();
+
+  // The regions are counted by the worker threads at once
+  countTraits(frames);
+  sums.herbivores = dietCount(0);
+  sums.carnivores = dietCount(1);
+  sums.size = traitSum(TRAIT_SIZE);
+  sums.speed = traitSum(TRAIT_SPEED);
+  sums.energy = traitSum(TRAIT_ENERGY);
+  sums.vision = traitSum(TRAIT_VISION);
+
+  message m;
+  if(shardRank != 0){
+    m.put(sums);
+    send(0, m);
+    return;
+  }
+  for(int p = 1; p < shardCount; ++p){
+    receive(p, m);
+    telemetry_t part = m.get<telemetry_t>();
+    sums.plants += part.plants;
+    sums.herbivores += part.herbivores;
+    sums.carnivores += part.carnivores;
+    sums.size += part.size;
+    sums.speed += part.speed;
+    sums.energy += part.energy;
+    sums.vision += part.vision;
+  }
 
-  std::fstream file;
-  file.open(fName, ios::app); 
-  
-  for(int i = 0; i < creatures.size(); ++i){
-    creature * c = creatures[i];
-    size += c->getTrait(1);
-    speed += c->getTrait(2);
-    energy += c->getTrait(3);
-    vision += c->getTrait(4);
-    
-    if(c->food_source() == 0){
-      ++herb;
-    }
-    else{
-      ++carn;
-    }
+  // A field counts its biomass in plants
+  if (grass.on) {
+    sums.plants /= FIELD_UNIT;
   }
+  storeTotals(frames + 1, sums.herbivores, sums.carnivores, sums.plants, lastId, islandEmigrants());
 
-  size = (double)size / creatures.size();
-  speed = (double)speed / creatures.size();
-  energy = (double)energy / creatures.size();
-  vision = (double)vision / creatures.size();
+  long count = sums.herbivores + sums.carnivores;
+  long size = (double)sums.size / count;
+  long speed = (double)sums.speed / count;
+  long energy = (double)sums.energy / count;
+  long vision = (double)sums.vision / count;
+
+  std::fstream file;
+  file.open(cfg.dataFile.c_str(), ios::app); 
 
-  file << 1.25*cos(2*3.1415*frames/10000)+1.75;
+  file << cfg.plantAmplitude*cos(2*3.1415*frames*cfg.dt/cfg.plantPeriod)+cfg.plantMean;
   file << ",";
-  file << plants.size();
+  file << sums.plants;
   file << ",";
-  file << herb;
+  file << sums.herbivores;
   file << ",";
-  file << carn;
+  file << sums.carnivores;
   file << ",";
   file << thisTime;
   file << ",";
@@ -219,10 +604,16 @@ void writeData(){
 // Draw a circle at the given creature's position
 // Uses method from http://groups.csail.mit.edu/graphics/classes/6.837/F98/Lecture6/circle.html
 void drawCreature(bitmap* bmp, creature * c) {
+  vec2d pos = c->pos();
+  double r = c->radius();
+  if (!inView(view, pos.x() - r, pos.y() - r, pos.x() + r, pos.y() + r)) {
+    return;
+  }
 
-  double center_x = c->pos().x();
-  double center_y = c->pos().y();
-  double radius = c->radius();
+  double center_x = (pos.x() - view.x) * view.scale;
+  double center_y = (pos.y() - view.y) * view.scale;
+  double radius = fmax(r * view.scale, 1);
+  double border = 3 * view.scale;
   rgb32 border_color;
   rgb32 inner_color = c->color();
 
@@ -244,7 +635,7 @@ void drawCreature(bitmap* bmp, creature * c) {
       // Is this point within the circle's radius?
       double dist = sqrt(pow(x, 2) + pow(y, 2));
       if(dist < radius) {
-        if (dist > radius - 3) {
+        if (dist > radius - border) {
           bmp->set(center_x + x, center_y + y, border_color);
           bmp->set(center_x + x, center_y - y, border_color);
           bmp->set(center_x - x, center_y - y, border_color);
@@ -263,9 +654,15 @@ void drawCreature(bitmap* bmp, creature * c) {
 }
 
 void drawPlant(bitmap* bmp, plant * p){
-  double center_x = p->pos().x();
-  double center_y = p->pos().y();
-  double radius = p->radius();
+  vec2d pos = p->pos();
+  double r = p->radius();
+  if (!inView(view, pos.x() - r, pos.y() - r, pos.x() + r, pos.y() + r)) {
+    return;
+  }
+
+  double center_x = (pos.x() - view.x) * view.scale;
+  double center_y = (pos.y() - view.y) * view.scale;
+  double radius = fmax(r * view.scale, 1);
   rgb32 color = rgb32(64, 64, 255);
   
   // Loop over points in the upper-right quad of the circle
@@ -284,260 +681,696 @@ void drawPlant(bitmap* bmp, plant * p){
   }
 }
 
-// Compute force on all creatures and update their positions
-void updateCreatures(){
-  resetTasks();
+// Shade every pixel of our stripe by the biomass of the cell under it
+void drawField(bitmap* bmp){
+  int y0, y1;
+  stripeRows(bmp, &y0, &y1);
+  int x1 = (int)fmin(bmp->width(), ceil((cfg.width - view.x) * view.scale));
+
+  for(int y = y0; y < y1; ++y){
+    for(int x = 0; x < x1; ++x){
+      vec2d pos(view.x + x / view.scale, view.y + y / view.scale);
+      int32_t m = grass.mass[cellOf(pos)];
+      if(m > 0){
+        double level = fmin(1, (double)m / fmax(grass.capacity, 1));
+        bmp->set(x, y, rgb32(64 * level, 64 * level, 255 * level));
+      }
+    }
+  }
+}
+
+// Get the rows of the window showing this process's stripe. Every row
+// belongs to one stripe
+void stripeRows(bitmap* bmp, int* y0, int* y1) {
+  *y0 = (int)fmax(0, ceil((regions[firstRegion].y0 - view.y) * view.scale));
+  *y1 = (int)fmin(bmp->height(), ceil((regions[lastRegion - 1].y1 - view.y) * view.scale));
+}
 
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
+// Add a region's creatures to the crowds, if the region is in view
+void crowdRegion(int r) {
+  region_t& reg = regions[r];
+  if (!regionInView(reg)) {
+    return;
+  }
+  startCrowd(r, reg.creatures.size());
+  eachInView(reg, reg.creatures, reg.drawGrid, [&](int i) {
+    addToCrowd(r, i, reg.creatures[i]);
+  });
+}
 
-  double cur_time = (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);//GetTickCount();
-    
-  //This updates position and checks for energy level
-  for(int i=0; i<creatures.size(); ++i) {
-    addTask(&handleTick, i);
+// Sort a region's creatures and plants into its draw grids, if the edge of
+// the view cuts through it. A region all in view draws everything anyway
+void cullRegion(int r) {
+  region_t& reg = regions[r];
+  reg.cut = regionInView(reg) && !allInView(view, reg.x0, reg.y0, reg.x1, reg.y1);
+  if (!reg.cut) {
+    return;
   }
+  double x0 = reg.x0 - ghostBand;
+  double y0 = reg.y0 - ghostBand;
+  double x1 = reg.x1 + ghostBand;
+  double y1 = reg.y1 + ghostBand;
+  reg.drawGrid.build(reg.creatures, x0, y0, x1, y1);
+  reg.drawPlantGrid.build(reg.plants, x0, y0, x1, y1);
+}
 
-  pthread_mutex_lock(&countTasks);
-  while(tasksFinished < creatures.size()){
-    pthread_cond_wait(&countCond, &countTasks);
+// Call f(i) for each of a region's creatures or plants that can be in view:
+// all of them, or where the view's edge cuts the region, those in the cells
+// of its draw grid the view touches. They stick out of a cell by their radius
+template<typename T, typename F>
+void eachInView(region_t& reg, std::vector<T*>& items, spatialGrid<T>& grid, F f) {
+  if (!reg.cut) {
+    for (int i = 0; i < items.size(); i++) {
+      f(i);
+    }
+    return;
   }
-  pthread_mutex_unlock(&countTasks);
+  double margin = cfg.maxRadius;
+  grid.queryArea(view.x - margin, view.y - margin,
+                 view.x + cfg.windowWidth / view.scale + margin,
+                 view.y + cfg.windowHeight / view.scale + margin, f);
+}
 
-  
-  gettimeofday(&tv, NULL);
+// Can anything of a region be in view. Its creatures may have stepped out of
+// it since they were sorted into it, and stick out of it by their radius
+bool regionInView(region_t& reg) {
+  double margin = cfg.maxRadius + maxStep;
+  return inView(view, reg.x0 - margin, reg.y0 - margin, reg.x1 + margin, reg.y1 + margin);
+}
 
-  double end_time = (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);//GetTickCount();
+// Compute force on all creatures and update their positions. Every phase runs
+// on the regions this process owns; with several processes, they swap copies
+// of the creatures along their edges between phases
+void updateCreatures(){
+  // Find out who can be seen from other regions, then collect their ghosts
+  runTasks(&findBorders, firstRegion, lastRegion);
+  if (shardCount > 1) sendBorders();
+  runTasks(&gatherGhosts, firstRegion, lastRegion);
+  phaseDone(PHASE_BORDERS);
+
+  double cur_time = GetTimeMs();
+
+  // Everyone looks around before anyone reacts, and reacts before anyone moves
+  runTasks(&perceiveRegion, firstRegion, lastRegion);
+  if (shardCount > 1) sendStatuses();
+  runTasks(&reactRegion, firstRegion, lastRegion);
+  phaseDone(PHASE_PERCEIVE);
+  runTasks(&moveRegion, firstRegion, lastRegion);
+  phaseDone(PHASE_MOVE);
+
+  thisTime = GetTimeMs() - cur_time;
+
+  // Collisions inside each region. Then the copies of other processes'
+  // creatures catch up, and the ghosts are sorted where they moved to
+  runTasks(&collideRegion, firstRegion, lastRegion);
+  if (grass.on) {
+    runTasks(&wantGrassRegion, firstRegion, lastRegion);
+    runTasks(&grazeRegion, firstRegion, lastRegion);
+  }
+  if (shardCount > 1) sendStates();
+  runTasks(&sortRegion, firstRegion, lastRegion);
+  phaseDone(PHASE_COLLIDE);
+
+  // The few collisions that cross region edges, and the babies of everyone who
+  // met a buddy, one region after another. Processes take turns in stripe order
+  if (shardRank > 0) receivePass();
+  for(int r=firstRegion; r<lastRegion; ++r) {
+    collideBorders(r);
+    mateRegion(r);
+  }
+  if (shardCount > 1) passOn();
+  phaseDone(PHASE_BORDER_PASS);
+
+  // Bury the dead and hand creatures that left a region to their new one
+  runTasks(&migrateRegion, firstRegion, lastRegion);
+  logDeaths(firstRegion, lastRegion);
+  if (shardCount > 1) sendMigrants();
+  runTasks(&receiveRegion, firstRegion, lastRegion);
+
+  // Every so often, put everyone back next to their neighbours in memory
+  if (cfg.sortPeriod > 0 && frames % cfg.sortPeriod == 0) {
+    runTasks(&reorderRegion, firstRegion, lastRegion);
+  }
+  phaseDone(PHASE_MIGRATE);
+}
 
-  thisTime = end_time - cur_time;
-  
-  //This checks for collisions
-  for(int i=0; i<creatures.size(); ++i) {
-
-    //Check for creature collisions
-    for(int j=i+1; j < creatures.size(); ++j) {
-      bool * colStatus = creatures[i]->checkCreatureCollision(creatures[j]);
-      if (colStatus[0]) { // If trying to reproduce
-        reproduce(creatures[i], creatures[j]);
-      }
+// Creatures forget what they were doing last frame, and note who is near the edge
+void findBorders(int r) {
+  region_t& reg = regions[r];
+  reg.border.clear();
+  reg.borderPlants.clear();
+  reg.dietIndices[HERBIVORE].clear();
+  reg.dietIndices[CARNIVORE].clear();
+
+  for(int i=0; i<reg.creatures.size(); ++i) {
+    creature* c = reg.creatures[i];
+    c->setStatus(3);
+    reg.dietIndices[c->food_source()].push_back(i);
+    if(nearEdge(reg, c->pos())) {
+      reg.border.push_back(c);
+    }
+  }
+  for(int i=0; i<reg.plants.size(); ++i) {
+    if(nearEdge(reg, reg.plants[i]->pos())) {
+      reg.borderPlants.push_back(reg.plants[i]);
+    }
+  }
+}
 
-      // If the status is set to eat another creature
-      if(colStatus[1]){
-        if(creatures[i]->food_source() == 1){
-          creatures[i]->incEnergy((creatures[j]->curr_energy()));
-          creatures[j]->incEnergy(-10000);
-        }
-        // otherwise
-        else{
-          creatures[j]->incEnergy((creatures[i]->curr_energy()));
-          creatures[i]->incEnergy(-10000);
-        }
+// Collect the ghosts from other regions and sort everything nearby by place
+void gatherGhosts(int r) {
+  region_t& reg = regions[r];
+  reg.ghosts.clear();
+  reg.ghostOwner.clear();
+  reg.nearbyPlants.assign(reg.plants.begin(), reg.plants.end());
+
+  for(int q=0; q<regions.size(); ++q) {
+    region_t& other = regions[q];
+    // Skip ourselves and regions too far away to have ghosts here
+    if(q == r || !inReach(reg, other)) {
+      continue;
+    }
+    for(int i=0; i<other.border.size(); ++i) {
+      if(inGhostBand(reg, other.border[i]->pos())) {
+        reg.ghosts.push_back(other.border[i]);
+        reg.ghostOwner.push_back(q);
       }
     }
+    for(int i=0; i<other.borderPlants.size(); ++i) {
+      if(inGhostBand(reg, other.borderPlants[i]->pos())) {
+        reg.nearbyPlants.push_back(other.borderPlants[i]);
+      }
+    }
+  }
 
+  double x0 = reg.x0 - ghostBand;
+  double y0 = reg.y0 - ghostBand;
+  double x1 = reg.x1 + ghostBand;
+  double y1 = reg.y1 + ghostBand;
+  reg.ghostGrid.build(reg.ghosts, x0, y0, x1, y1);
+  reg.plantGrid.build(reg.nearbyPlants, x0, y0, x1, y1);
 
-    //Check for plant collisions
-    if(creatures[i]->food_source() == 0){
-      for(int j = 0; j < plants.size(); ++j){
-        bool collided = plants[j]->checkCreatureCollision(creatures[i]);
-        if(collided){
-          plants.erase(plants.begin() + j);
-          --j;
-          creatures[i]->incEnergy();
-        }
+  // Newcomers and those who wandered off since the last tick need new lists
+  refreshNeighbours(reg);
+
+  // Group the creatures ready to reproduce, ghosts included
+  reg.mates.clear();
+  for(int i=0; i<reg.creatures.size(); ++i) {
+    reg.mates.add(reg.creatures[i]);
+  }
+  for(int i=0; i<reg.ghosts.size(); ++i) {
+    reg.mates.add(reg.ghosts[i]);
+  }
+}
+
+// Every creature of the region looks around, herbivores first then carnivores
+void perceiveRegion(int r) {
+  region_t& reg = regions[r];
+  reg.seen.resize(reg.creatures.size());
+  perceiveDiet<HERBIVORE>(reg);
+  perceiveDiet<CARNIVORE>(reg);
+}
+
+// Every creature of one diet in a region looks around
+template<int Diet>
+void perceiveDiet(region_t& reg) {
+  vector<int>& indices = reg.dietIndices[Diet];
+  for(int k=0; k<indices.size(); ++k) {
+    int i = indices[k];
+    creature* c = reg.creatures[i];
+    if(!c->bouncing() && plansNow(c)){ // if the creature is not bouncing off another
+      perceive<Diet>(reg, i, &reg.seen[i]); // look around once
+      if(reg.seen[i].threatened) {
+        c->setStatus(0); // nobody reads statuses until everyone has looked around
       }
     }
-    // if the creature has no energy
-    if(creatures[i]->curr_energy() <= 0){ 
-      creatures.erase(creatures.begin() + i); // die
-      --i;
-      }
+    else if(!c->bouncing()) {
+      // Going by the last plan: still fleeing, after a buddy or after food.
+      // Set here rather than in steer(), so other processes see it too
+      c->setStatus(c->planStatus());
+    }
   }
 }
 
-// Initialize creatures
-void initCreatures() {
-  for (int i = 0; i < NUM_CREATURES; i++) {
-    creature * new_creature = new creature(0, 128, 128, 128, 128, 128);
-    creatures.push_back(new_creature);
+// Every creature of the region runs away, finds a buddy or finds food
+void reactRegion(int r) {
+  region_t& reg = regions[r];
+  for(int i=0; i<reg.creatures.size(); ++i) {
+    creature* c = reg.creatures[i];
+    if(c->bouncing()){
+      continue;
+    }
+    if(plansNow(c)){
+      react(c, &reg.seen[i]);
+    }
+    else {
+      steer(c);
+    }
   }
-  for (int i = 0; i < NUM_CREATURES / 10; ++i){
-    creature * new_creature = new creature(1, 128, 128, 128, 128, 128);
-    creatures.push_back(new_creature);
+}
+
+// Every creature of the region moves and burns energy
+void moveRegion(int r) {
+  region_t& reg = regions[r];
+  v2d walls = {(double)cfg.width, (double)cfg.height};
+  reg.starved.clear();
+  for(int i=0; i<reg.creatures.size(); ++i) {
+    creature* c = reg.creatures[i];
+    c->setBouncing(false);
+    if (c->move(walls)) {
+      reg.starved.push_back(i);
+    }
   }
-  
 }
 
-// Perform the functions needed on each creature each frame
-void handleTick(int i) {
-  if(!creatures[i]->bouncing()){ // if the creature is not bouncing off another
-    runAway(creatures[i]); // either run away
-    findNearestBuddy(creatures[i]); // or find a buddy
-    findNearestFood(creatures[i]); // or find food
+// Did two creatures touch during their last steps. If they met partway, both
+// go back to where they met, to bounce off each other there instead of
+// passing through each other, and go the rest of the step once every
+// collision is done
+bool meet(creature* c, creature* d) {
+  vec2d gap = d->prevPos() - c->prevPos();
+  vec2d closing = (d->pos() - d->prevPos()) - (c->pos() - c->prevPos());
+
+  // A hair inside touching, so checkCreatureCollision agrees they touch
+  double t = timeOfImpact(gap, closing, (c->radius() + d->radius()) * (1 - 1e-9));
+  if (t < 0) {
+    return false;
   }
-  else{
-    creatures[i]->setBouncing(false);
+  if (t > 0) {
+    c->rewind(t);
+    d->rewind(t);
   }
-    
-  creatures[i]->update(); // update the creatures position and such
-  creatures[i]->decEnergy(); // decrement the energy of the creature
+  return true;
 }
 
-// Finds the nearest food to a creature, and change velocity vector
-void findNearestFood(creature * c) {
-  // If a carnivore, go find an herbivore
-  if (c->food_source() == 1) {
-    findNearestHerbivore(c);
-    return;
+// Handle two creatures that touch
+void collide(region_t& reg, creature* c, creature* d) {
+  bool colStatus[2];
+  c->checkCreatureCollision(d, colStatus);
+  if (colStatus[0]) { // If trying to reproduce, make the baby once everyone is done
+    c->setStatus(3);
+    d->setStatus(3);
+    c->setPlan(PLAN_STALE, vec2d(), 3);
+    d->setPlan(PLAN_STALE, vec2d(), 3);
+    mating_t m = { c, d };
+    reg.matings.push_back(m);
   }
-  else if (c->status() < 2) { // choose to reproduce or run away over eat
-    return;
+
+  // If the status is set to eat another creature
+  if(colStatus[1]){
+    if(c->food_source() == CARNIVORE){
+      c->incEnergy(d->curr_energy());
+      d->incEnergy(-10000);
+    }
+    // otherwise
+    else{
+      d->incEnergy(c->curr_energy());
+      c->incEnergy(-10000);
+    }
   }
+}
+
+// Check collisions between the creatures and plants that a region owns
+void collideRegion(int r) {
+  region_t& reg = regions[r];
+  int own = reg.creatures.size();
+  int ownPlants = reg.plants.size();
 
-  // Set the minimum distance as the farthest it can be to be visible
-  double minDist = c->vision();
-  // Se the current closest plant to the first one
-  plant* closest = (plant *)malloc(sizeof(plant));
-  // Find the closest plant, and save it
-  for (int i = 0; i < plants.size(); i++) {
-    double curr_dist = plants[i]->distFromCreature(*c);
-    if (curr_dist < minDist) {
-      minDist = curr_dist;
-      closest = plants[i];
+  // Everyone moved, so some need new lists
+  refreshNeighbours(reg);
+
+  for(int i=0; i<own; ++i) {
+    creature* c = reg.creatures[i];
+    if(c->curr_energy() <= 0){ // Eaten earlier this frame
+      continue;
+    }
+
+    //Check for creature collisions, each pair once
+    vector<int>& list = reg.neighbours[i];
+    for(int k=0; k<list.size(); ++k) {
+      int j = list[k];
+      creature* d = reg.creatures[j];
+      if (j <= i || d->curr_energy() <= 0 || c->curr_energy() <= 0) {
+        continue;
+      }
+      // Most neighbours are only in sight, nowhere near touching
+      vec2d gap = d->pos() - c->pos();
+      double near = c->radius() + d->radius() + c->speed() + d->speed();
+      if (gap * gap > near * near || !meet(c, d)) {
+        continue;
+      }
+      collide(reg, c, d);
+    }
+
+    //Check for plant collisions
+    if(c->food_source() == HERBIVORE && c->curr_energy() > 0){
+      reg.plantGrid.query(c->pos(), c->radius() + 2 + c->speed(), [&](int j) {
+        plant* p = reg.nearbyPlants[j];
+        if(j < ownPlants && !p->eaten() && p->checkCreatureCollision(c)){
+          p->setEaten();
+          c->incEnergy();
+        }
+      });
     }
   }
+}
 
-  // If the distance is still vision, we found nothing, so don't reset the vector
-  if (minDist != c->vision()) {
-    // Now that we have the closest plant,
-    // change the creature's velocity vector to go towards that plant
-    vec2d cPos = c->pos();
-    vec2d pPos = closest->pos();
-    vec2d towards = vec2d(pPos.x() - cPos.x(), pPos.y() - cPos.y());
-    c->setVel(towards);
-    c->setStatus(2);
+// Every live herbivore of the region asks for a bite of the field under it
+void wantGrassRegion(int r) {
+  region_t& reg = regions[r];
+  vector<int>& indices = reg.dietIndices[HERBIVORE];
+  for(int k=0; k<indices.size(); ++k) {
+    creature* c = reg.creatures[indices[k]];
+    if(c->curr_energy() > 0){
+      wantGrass(c, r);
+    }
   }
 }
 
-// Find the nearest herbivore to eat and change velocity vectors
-void findNearestHerbivore(creature* c) {
-  // If reproducing or an herbivore, keep doing your thing
-  if (c->status() == 1 || c->food_source() == 0) { 
-    return;
+// Every live herbivore of the region takes its bite, once everyone has asked
+void grazeRegion(int r) {
+  region_t& reg = regions[r];
+  vector<int>& indices = reg.dietIndices[HERBIVORE];
+  for(int k=0; k<indices.size(); ++k) {
+    creature* c = reg.creatures[indices[k]];
+    if(c->curr_energy() > 0){
+      c->incEnergy(graze(c, r) * cfg.fps);
+    }
   }
-  
-  // Set the minimum distance as the farthest it can be to be visible
-  double minDist = c->vision();
-  // Se the current closest creature to the first one
-  creature* closest = (creature *)malloc(sizeof(creature));
-  // Find the closest creature, and save it
-  for (int i = 0; i < creatures.size(); i++) {
-    // Make sure we are eating an herbivore
-    if (creatures[i]->food_source() == 0 && c->canEat(creatures[i])) {
-      double curr_dist = c->distFromCreature(*creatures[i]) - creatures[i]->radius();
-      if(curr_dist < minDist){
-        minDist = curr_dist;
-        closest = creatures[i];
+}
+
+// Sort the ghosts again where they moved to
+void sortRegion(int r) {
+  region_t& reg = regions[r];
+  reg.ghostGrid.build(reg.ghosts, reg.x0 - ghostBand, reg.y0 - ghostBand,
+                      reg.x1 + ghostBand, reg.y1 + ghostBand);
+}
+
+// Check collisions between a region's creatures and the creatures and plants
+// of other regions. Each creature pair is handled by the lower numbered region
+void collideBorders(int r) {
+  region_t& reg = regions[r];
+  int ownPlants = reg.plants.size();
+
+  for(int b=0; b<reg.border.size(); ++b) {
+    creature* c = reg.border[b];
+    if(c->curr_energy() <= 0){
+      continue;
+    }
+
+    reg.ghostGrid.query(c->pos(), c->radius() + cfg.maxRadius + c->speed() + maxStep, [&](int j) {
+      creature* d = reg.ghosts[j];
+      if (reg.ghostOwner[j] < r || d->curr_energy() <= 0 || c->curr_energy() <= 0 || !meet(c, d)) {
+        return;
       }
+      collide(reg, c, d);
+    });
+
+    if(c->food_source() == HERBIVORE && c->curr_energy() > 0){
+      reg.plantGrid.query(c->pos(), c->radius() + 2 + c->speed(), [&](int j) {
+        plant* p = reg.nearbyPlants[j];
+        if(j >= ownPlants && !p->eaten() && p->checkCreatureCollision(c)){
+          p->setEaten();
+          c->incEnergy();
+        }
+      });
     }
   }
+}
 
-  // If the distance is still vision, we found nothing, so don't reset the vector
-  if (minDist < c->vision()) {
-    // Now that we have the closest creature for eating,
-    // change the creature's velocity vector to go towards that creature
-    vec2d cPos = c->pos();
-    vec2d ePos = closest->pos();
-    vec2d towards = ePos - cPos;
-    c->setVel(towards);
-    c->setStatus(2);
+// Make the babies of everyone in a region who met a buddy
+void mateRegion(int r) {
+  region_t& reg = regions[r];
+  for(int m=0; m<reg.matings.size(); ++m) {
+    reproduce(reg.matings[m].c, reg.matings[m].d);
   }
+  reg.matings.clear();
 }
 
-//Creature run away from the carnivore 
-void runAway(creature* c) {
-  // If you are a carnivore, you never have to run away
-  if (c->food_source() == 1) { 
-    return;
-  }
+// Remove eaten plants and dead creatures, let the living go the rest of any
+// step a meeting cut short, and send away creatures that left
+void migrateRegion(int r) {
+  region_t& reg = regions[r];
 
-  double minDist = c->vision();
-  bool found = false;
-  vec2d away = vec2d(0,0);
-    
-  // Find the closest creature, and save it
-  for (int i = 0; i < creatures.size(); i++) {
-    creature* carnivore = creatures[i];
-    
-    // Make sure we are running from a carnivore
-    if (carnivore->food_source() == 1 && carnivore->canEat(c)) {
-      double curr_dist = c->distFromCreature(*carnivore) - creatures[i]->radius();
-      if(curr_dist <= minDist){
-        away = (away + (c->pos() - carnivore->pos()).normalized()).normalized();
-        found = true;
-      }
+  int kept = 0;
+  for(int j=0; j<reg.plants.size(); ++j) {
+    if(reg.plants[j]->eaten()) {
+      delete reg.plants[j];
+    }
+    else {
+      reg.plants[kept++] = reg.plants[j];
     }
   }
-
-  // If the creature is not us, RUN AWAY
-  if (found) { 
-    c->setVel(away);
-    c->setStatus(0); //Set status to RUN AWAY
+  reg.plants.resize(kept);
+
+  kept = 0;
+  vector<int> keptAs(reg.creatures.size(), -1);
+  int starved = 0; // Next of the creatures that starved
+  for(int i=0; i<reg.creatures.size(); ++i) {
+    creature* c = reg.creatures[i];
+    if (c->curr_energy() > 0) {
+      c->finishStep();
+    }
+    int dest = regionOf(c->pos());
+    while (starved < reg.starved.size() && reg.starved[starved] < i) {
+      ++starved;
+    }
+    if(c->curr_energy() <= 0) { // die, of hunger or in a carnivore
+      int cause = starved < reg.starved.size() && reg.starved[starved] == i ? DEATH_STARVED : DEATH_EATEN;
+      noteDeath(r, c->id(), frames, c->food_source(), c->genome(), cause);
+      delete c;
+    }
+    else if(dest != r) {
+      reg.outbox[dest].push_back(c);
+    }
+    else {
+      keptAs[i] = kept;
+      reg.creatures[kept++] = c;
+    }
   }
+  reg.creatures.resize(kept);
+  renumberNeighbours(reg, keptAs);
 }
 
+// Take in the creatures that moved here from other regions
+void receiveRegion(int r) {
+  region_t& reg = regions[r];
+  for(int q=0; q<regions.size(); ++q) {
+    vector<creature*>& arriving = regions[q].outbox[r];
+    reg.creatures.insert(reg.creatures.end(), arriving.begin(), arriving.end());
+    arriving.clear();
+  }
+}
 
-// Finds the nearest buddy for reproduction
-void findNearestBuddy(creature* c) {
-  if (c->status() < 1) { // If we are being chased, DON'T FIND A BUDDY
-    return;
+// Put a region's creatures and plants in Z-order, in memory as well as in the
+// region's lists. Nothing else may hold on to them across this, so it runs
+// at the end of a tick, when the ghosts and perceptions are stale anyway
+void reorderRegion(int r) {
+  region_t& reg = regions[r];
+  double x0 = reg.x0 - ghostBand;
+  double y0 = reg.y0 - ghostBand;
+
+  // Newcomers need a list before the lists can be renumbered
+  refreshNeighbours(reg);
+  vector<int> order = mortonOrder(reg.creatures, x0, y0);
+  vector<creature*> creatures(order.size());
+  for(int k=0; k<order.size(); ++k) {
+    creatures[k] = reg.creatures[order[k]];
+  }
+  reg.creatures.swap(creatures);
+  permuteNeighbours(reg, order);
+  pack(reg.creatures);
+
+  order = mortonOrder(reg.plants, x0, y0);
+  vector<plant*> plants(order.size());
+  for(int k=0; k<order.size(); ++k) {
+    plants[k] = reg.plants[order[k]];
   }
+  reg.plants.swap(plants);
+  pack(reg.plants);
+}
 
-  double matingDist = c->vision() * 2;
+// Initialize creatures
+void initCreatures() {
+  for (int i = 0; i < cfg.herbivores; i++) {
+    creature* c = new creature(HERBIVORE, 128, 128, 128, 128, 128);
+    c->setId(newId());
+    addCreature(c);
+  }
+  for (int i = 0; i < cfg.carnivores; ++i){
+    creature* c = new creature(CARNIVORE, 128, 128, 128, 128, 128);
+    c->setId(newId());
+    addCreature(c);
+  }
   
-  if ((c->curr_energy() / c->max_energy()) >= 0.7) {
-    double minDist = matingDist;
-    creature* closest = (creature *)malloc(sizeof(creature));
-    int type = c->food_source();
-    
-    // Find the closest creature, and save it
-    for (int i = 0; i < creatures.size(); i++) {
-      creature* buddy = creatures[i];
-      double curr_dist = buddy->distFromCreature(*c);
-      if (curr_dist != 0) { // Make sure our buddy is not us
-        // Check qualifications for reproduction
-        if (curr_dist < minDist && //Did we find a closer buddy
-            buddy->food_source() == type && //Is the buddy our food type
-            (buddy->curr_energy() / buddy->max_energy()) >= 0.7 && //Does buddy have the energy
-            reproductionSimilarity(c, buddy)){ //Are we the same species
-          minDist = curr_dist;
-          closest = buddy;
-        }
+}
+
+// Look at every neighbour once and remember everything a creature cares about
+template<int Diet>
+void perceive(region_t& reg, int i, perception_t* p) {
+  creature* c = reg.creatures[i];
+  p->threatened = false;
+  p->away = vec2d(0,0);
+  p->mate = NULL;
+  p->prey = NULL;
+  p->food = NULL;
+  p->grazing = false;
+
+  vec2d cPos = c->pos();
+  double vision = c->vision();
+  double preyMin = vision;
+
+  auto look = [&](creature* other) {
+    // Creatures of our own diet are neither threats nor prey
+    if (other->food_source() == Diet) {
+      return;
+    }
+
+    vec2d oPos = other->pos();
+    double dx = oPos.x() - cPos.x();
+    double dy = oPos.y() - cPos.y();
+    double dist = sqrt(dx*dx + dy*dy);
+
+    if (Diet == HERBIVORE) {
+      // Herbivores flee from every carnivore that could eat them
+      if (other->canEat(c) && dist - other->radius() <= vision) {
+        p->away = (p->away + (cPos - oPos).normalized()).normalized();
+        p->threatened = true;
       }
     }
+    else {
+      // Carnivores hunt the closest herbivore they can eat
+      double edge = dist - other->radius();
+      if (edge < preyMin && c->canEat(other)) {
+        preyMin = edge;
+        p->prey = other;
+      }
+    }
+  };
+
+  // Our neighbours come from our list, the ghosts from the grid, where nobody
+  // further away than this can be seen, even at their edge
+  vector<int>& list = reg.neighbours[i];
+  for (int k = 0; k < list.size(); k++) {
+    look(reg.creatures[list[k]]);
+  }
+  double range = vision + cfg.maxRadius;
+  reg.ghostGrid.query(cPos, range, [&](int k) {
+    look(reg.ghosts[k]);
+  });
+
+  // Buddies come from the mate index, which only holds possible matches
+  if (!p->threatened && c->readyToMate()) {
+    p->mate = reg.mates.nearest(c, vision * 2);
+  }
 
-    // go towards buddy
-    if (closest->status() > 0 && minDist < matingDist) { 
-      vec2d cPos = c->pos();
-      vec2d bPos = closest->pos();
-      vec2d towardsB = vec2d(bPos.x() - cPos.x(), bPos.y() - cPos.y());
-      //vec2d towardsC = vec2d(cPos.x() - bPos.x(), cPos.y() - bPos.y());
-      c->setVel(towardsB);
-      //closest->setVel(towardsC);
-      c->setStatus(1);
-      //closest->setStatus(1);
+  // Plants only matter to herbivores that aren't fleeing. The buddy may turn
+  // out to be fleeing itself, so look for food even if we found one
+  if (Diet == HERBIVORE && !p->threatened) {
+    double foodMin = vision;
+    reg.plantGrid.query(cPos, vision, [&](int k) {
+      vec2d pPos = reg.nearbyPlants[k]->pos();
+      double dx = pPos.x() - cPos.x();
+      double dy = pPos.y() - cPos.y();
+      double dist = sqrt(dx*dx + dy*dy);
+      if (dist < foodMin) {
+        foodMin = dist;
+        p->food = reg.nearbyPlants[k];
+      }
+    });
+    if (grass.on) {
+      p->grazing = findGrass(cPos, vision, &p->pasture);
     }
   }
 }
 
+// Steer a creature using what it perceived: flee over mate over eat
+void react(creature* c, perception_t* p) {
+  vec2d cPos = c->pos();
+
+  if (p->threatened) { // RUN AWAY
+    c->setVel(p->away);
+    c->setStatus(0);
+    c->setPlan(PLAN_FLEE, p->away, 0);
+  }
+  else if (p->mate != NULL && p->mate->status() > 0) { // go towards buddy
+    vec2d target = leadTarget(c, p->mate);
+    c->setVel(target - cPos);
+    c->setStatus(1);
+    c->setPlan(PLAN_SEEK, target, 1);
+  }
+  else if (p->prey != NULL) { // go eat the herbivore
+    vec2d target = leadTarget(c, p->prey);
+    c->setVel(target - cPos);
+    c->setStatus(2);
+    c->setPlan(PLAN_SEEK, target, 2);
+  }
+  else if (p->food != NULL) { // go eat the plant
+    c->setVel(p->food->pos() - cPos);
+    c->setStatus(2);
+    c->setPlan(PLAN_SEEK, p->food->pos(), 2);
+  }
+  else if (p->grazing) { // go where the grass is richer
+    c->setVel(p->pasture - cPos);
+    c->setStatus(2);
+    c->setPlan(PLAN_SEEK, p->pasture, 2);
+  }
+  else {
+    c->setPlan(PLAN_WANDER, vec2d(), 3);
+  }
+}
+
+// Get where to head for to catch another creature. With a frame a tick, that
+// is where it is, as we look again next frame. A longer step goes straight,
+// so head for where it will be when we can get there, going as it went
+// last step, but no further ahead than the step's last frame
+vec2d leadTarget(creature* c, creature* d) {
+  if (cfg.dt <= 1) {
+    return d->pos();
+  }
+  vec2d gap = d->pos() - c->pos();
+  vec2d v = (d->pos() - d->prevPos()) * (1 / cfg.dt); // Per frame
+  double s = c->speed() / cfg.dt;
+
+  // The first frame f where |gap + v f| = s f, if we are fast enough
+  double a = v * v - s * s;
+  double b = gap * v;
+  double disc = b * b - a * (gap * gap);
+  double f = cfg.dt - 1;
+  if (a < 0 && disc >= 0) {
+    f = fmin(f, (-b - sqrt(disc)) / a);
+  }
+  return d->pos() + v * f;
+}
+
+// Does a creature plan where to go this tick: on its turn, or when it has no
+// plan. Creatures take turns, so about the same number plan every tick
+bool plansNow(creature* c) {
+  return planPeriod == 1 || c->plan() == PLAN_STALE ||
+    (frames + c->planPhase(planPeriod)) % planPeriod == 0;
+}
+
+// Keep going by the last plan: away from the threats seen then, or towards
+// where the buddy, prey or food was
+void steer(creature* c) {
+  if (c->plan() == PLAN_FLEE) {
+    c->setVel(c->target());
+  }
+  else if (c->plan() == PLAN_SEEK) {
+    c->setVel(c->target() - c->pos());
+  }
+}
+
 // Reproduce with new creature
 void reproduce(creature* c, creature* d) {
 
   // Set the status of the parents back to doing nothing
   c->setStatus(3);
   d->setStatus(3);
+  c->setPlan(PLAN_STALE, vec2d(), 3);
+  d->setPlan(PLAN_STALE, vec2d(), 3);
 
-  int carnMut = rand() % 100;
+  int carnMut = simRand() % 100;
   int children = 1;
   int food = c->food_source();
 
@@ -548,12 +1381,16 @@ void reproduce(creature* c, creature* d) {
 
   for(int i = 0; i < children; ++i){
     // Create new baby creature
-    creature * baby = new creature(food, new_trait(c, d, 0),
-                                   new_trait(c, d, 1), new_trait(c, d, 2),
-                                   new_trait(c, d, 3), new_trait(c, d, 4));
-
-    // Add baby creature to the vector
-    creatures.push_back(baby);
+    creature * baby = new creature(food, new_genome(c, d));
+    baby->setId(newId());
+    logBirth(baby->id(), c->id(), d->id(), frames, food, baby->genome());
+
+    // Add baby creature to the region it was born in. Other processes make
+    // their copy of it from its state
+    if(shardCount > 1){
+      births.push_back(baby->state());
+    }
+    addCreature(baby);
   }
 
   // Deplete parents energy
@@ -561,77 +1398,16 @@ void reproduce(creature* c, creature* d) {
   d->halfEnergy();
 }
 
-// Create new trait from that of the parents
-uint8_t new_trait(creature* c, creature* d, int trait) {
-
-  uint8_t parent1 = c->getTrait(trait);
-  uint8_t parent2 = d->getTrait(trait);
-
-  int mut = rand() % 4;
-  int mutBit = -1;
-  if(mut == 0){ //25% chance of mutation
-    mutBit = rand() % 8; //Selects the bit for mutation
-  }
-  
-  uint8_t ret = 0; //The new value for the creature
-  for (int i = 0; i < 8;  i++) { //For each bit in the trait
-    int parent = rand() % 2; // Select a random parent
-    if (parent == 0) { //Take trait from parent1
-      //If the bit in the ith position is a 1, add a 1 in that position
-      if((uint8_t)(pow(2,i)) & parent1){ 
-        ret += (uint8_t)(pow(2,i));
-      }
-    }
-    else{ //take trait from parent 2
-      //If the bit in the ith position is a 1, add a 1 in that position
-      if((uint8_t)(pow(2,i)) & parent2){
-        ret += (uint8_t)(pow(2,i));
-      }
-    }
-  }
-
-  if(mutBit != -1){ // If we are mutating, mutate
-    
-    if(ret & (uint8_t)(pow(2,mutBit))){
-      ret -= (uint8_t)(pow(2,mutBit));
-    }
-    else{
-      ret += (uint8_t)(pow(2,mutBit));
-    }
-  } 
-  
-  return ret;
-}
-
 // Check if the creatures are similar enough to reproduce
 bool reproductionSimilarity(creature* c, creature* d) {
-  int count = 0;
-  
-  for (int i = 1; i < 5; i++) { // iterate over all 4 traits
-    uint8_t p1 = c->getTrait(i);
-    uint8_t p2 = d->getTrait(i);
-    for (int j = 0; j < 8; j++) { // iterate over bits in trait
-      if (((uint8_t)(2^i) & p1) != ((uint8_t)(2^i) & p2)) {
-        ++count;
-      }
-    }
-  }
-  
-  if (count < 8) {
-    return true;
-  }
-  else {
-    return false;
-  }
+  return c->sameSpecies(d);
 }
 
-//The similar function as Window's function GetTickCount 
-//code from: http://www.doctort.org/adam/nerd-notes/linux-equivalent-of-the-windows-gettickcount-function.html
-unsigned GetTickCount()
+//Get elapsed time in miliseconds, with sub-millisecond precision, on a
+//clock that never jumps
+double GetTimeMs()
 {
-  struct timeval tv;
-  if(gettimeofday(&tv, NULL) != 0)
-    return 0;
-
-  return (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
 }
@@ -0,0 +1,254 @@
+/* field.hh is the other way to feed herbivores (--food=field): instead of  *
+ * plants, the world is covered by a coarse grid of biomass. Every tick,    *
+ * each cell grows with the plant season, spreads to the cells around it   *
+ * and is grazed by the herbivores on it, so memory and time depend on the *
+ * size of the grid alone, however much food there is. Biomass is fixed    *
+ * point, so it adds up the same whatever order things happen in, and     *
+ * cell rows never cross region rows, so each cell has one owner process.  */
+
+#if !defined(FIELD_HH)
+#define FIELD_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "threads.hh"
+#include "world.hh"
+
+#define FIELD_UNIT 65536 // Biomass of one plant
+#define FIELD_BAND 16    // Rows of cells grown or spread by one task
+#define FIELD_LOOKS 8    // Directions a herbivore looks for grass in
+#define FIELD_RINGS 3    // Distances it looks at in each direction
+
+// Four cells, in one SIMD register
+typedef int32_t v4i __attribute__((vector_size(16)));
+
+typedef struct field {
+  bool on;                     // Is the food a field rather than plants
+  int cols, rows;              // Cells across and down the world
+  int rowsPerRegion;           // Cell rows in each row of regions
+  int32_t capacity;            // Most biomass a cell holds
+  int32_t spread;              // 256ths of a cell that go to each neighbour every tick
+  std::vector<int32_t> mass;   // Biomass of every cell, row by row
+  std::vector<int32_t> next;   // Where the next tick's biomass is spread to
+  std::vector<int32_t> demand; // Biomass the herbivores on each cell want this tick
+
+  // The rows this process grows, and how many rows around them it keeps
+  // up to date for its creatures to look at
+  int firstRow, lastRow;
+  int halo;
+
+  // Growth owed to every cell for fractions of a unit so far, what every
+  // cell grows this tick, and the rows spread this tick
+  double owed;
+  int32_t growth;
+  int spreadFirst, spreadLast;
+} field_t;
+
+field_t grass;
+
+// Get the first cell row of a process's stripe, the same way setStripe splits regions
+int stripeRow(int process, int processes) {
+  return regionRows * process / processes * grass.rowsPerRegion;
+}
+
+// Size the field to the world and the regions, and keep up the rows of one
+// process's stripe. Cells start bare, like a world without plants
+void initField(int process, int processes) {
+  grass.on = cfg.food == "field";
+  if (!grass.on) {
+    return;
+  }
+  double regionHeight = (double)cfg.height / regionRows;
+  grass.cols = (int)fmax(1, ceil(cfg.width / cfg.cellSize));
+  grass.rowsPerRegion = (int)fmax(1, ceil(regionHeight / cfg.cellSize));
+  grass.rows = regionRows * grass.rowsPerRegion;
+  grass.capacity = (int32_t)(cfg.fieldCapacity * FIELD_UNIT);
+  grass.spread = (int32_t)(cfg.fieldSpread * 256);
+
+  size_t cells = (size_t)grass.cols * grass.rows;
+  grass.mass.assign(cells, 0);
+  grass.next.assign(cells, 0);
+  grass.demand.assign(cells, 0);
+
+  grass.firstRow = stripeRow(process, processes);
+  grass.lastRow = stripeRow(process + 1, processes);
+  grass.halo = processes > 1 ? (int)ceil(ghostBand / (regionHeight / grass.rowsPerRegion)) + 1 : 0;
+  grass.owed = 0;
+}
+
+// Get the cell under a position, the nearest one for positions outside the world
+int cellOf(vec2d pos) {
+  int col = (int)(pos.x() * grass.cols / cfg.width);
+  int row = (int)(pos.y() * grass.rows / cfg.height);
+  col = col < 0 ? 0 : (col >= grass.cols ? grass.cols - 1 : col);
+  row = row < 0 ? 0 : (row >= grass.rows ? grass.rows - 1 : row);
+  return row * grass.cols + col;
+}
+
+// Get the cell under a position, or the nearest one in the rows of a region.
+// A creature grazes in its own region, whose process owns the cell, even
+// when it has just stepped out of it
+int cellIn(vec2d pos, int reg) {
+  int cell = cellOf(pos);
+  int first = reg / regionCols * grass.rowsPerRegion * grass.cols;
+  int last = first + grass.rowsPerRegion * grass.cols;
+  return cell < first ? cell % grass.cols + first : (cell >= last ? cell % grass.cols + last - grass.cols : cell);
+}
+
+// Get the middle of a cell
+vec2d cellCenter(int cell) {
+  double col = cell % grass.cols + 0.5;
+  double row = cell / grass.cols + 0.5;
+  return vec2d(col * cfg.width / grass.cols, row * cfg.height / grass.rows);
+}
+
+// Get the biomass a herbivore takes in one tick
+int32_t biteSize() {
+  return (int32_t)(cfg.grazeRate * cfg.dt * FIELD_UNIT);
+}
+
+// Ask for a bite of the cell under a herbivore of a region. Herbivores of
+// several regions may share a cell, so the asking is atomic
+void wantGrass(creature* c, int reg) {
+  int32_t* d = &grass.demand[cellIn(c->pos(), reg)];
+  __atomic_fetch_add(d, biteSize(), __ATOMIC_RELAXED);
+}
+
+// Take a herbivore's bite once everyone has asked: all of it if the cell has
+// enough for everyone on it, or a fair part otherwise. Returns the plants eaten
+double graze(creature* c, int reg) {
+  int cell = cellIn(c->pos(), reg);
+  int64_t bite = biteSize();
+  int64_t mass = grass.mass[cell];
+  int64_t demand = grass.demand[cell];
+  if (demand > mass) {
+    bite = bite * mass / demand;
+  }
+  return (double)bite / FIELD_UNIT;
+}
+
+// Look for the richest grass in sight: around the herbivore in every
+// direction, at a few distances. Returns true and where it is, if it is
+// richer than the grass underfoot
+bool findGrass(vec2d pos, double vision, vec2d* at) {
+  static const double dirs[FIELD_LOOKS][2] = {
+    {1, 0}, {M_SQRT1_2, M_SQRT1_2}, {0, 1}, {-M_SQRT1_2, M_SQRT1_2},
+    {-1, 0}, {-M_SQRT1_2, -M_SQRT1_2}, {0, -1}, {M_SQRT1_2, -M_SQRT1_2}
+  };
+  int here = cellOf(pos);
+  int best = here;
+  for (int ring = 1; ring <= FIELD_RINGS; ring++) {
+    double dist = vision * ring / FIELD_RINGS;
+    for (int k = 0; k < FIELD_LOOKS; k++) {
+      vec2d look = pos + vec2d(dirs[k][0] * dist, dirs[k][1] * dist);
+      if (look.x() < 0 || look.x() >= cfg.width || look.y() < 0 || look.y() >= cfg.height) {
+        continue;
+      }
+      int cell = cellOf(look);
+      if (grass.mass[cell] > grass.mass[best]) {
+        best = cell;
+      }
+    }
+  }
+  if (best == here) {
+    return false;
+  }
+  *at = cellCenter(best);
+  return true;
+}
+
+// Get how many bands of rows there are from one row to another
+int bandsOf(int first, int last) {
+  return (last - first + FIELD_BAND - 1) / FIELD_BAND;
+}
+
+// Take what was grazed off a band of our rows, and grow what is left, up to capacity
+void growBand(int band) {
+  int first = grass.firstRow + band * FIELD_BAND;
+  int last = std::min(first + FIELD_BAND, grass.lastRow);
+  for (size_t i = (size_t)first * grass.cols; i < (size_t)last * grass.cols; i++) {
+    int32_t m = grass.mass[i] - std::min(grass.mass[i], grass.demand[i]);
+    grass.mass[i] = std::min(m + grass.growth, grass.capacity);
+    grass.demand[i] = 0;
+  }
+}
+
+// Spread one cell, given its four neighbours
+int32_t spreadCell(int32_t m, int32_t around) {
+  return (m * (256 - 4 * grass.spread) + around * grass.spread) >> 8;
+}
+
+// Spread a band of rows into the next field. Cells at the edge of the world
+// count themselves for the neighbours they don't have
+void spreadBand(int band) {
+  int first = grass.spreadFirst + band * FIELD_BAND;
+  int last = std::min(first + FIELD_BAND, grass.spreadLast);
+  int cols = grass.cols;
+  v4i keep = {256 - 4 * grass.spread, 256 - 4 * grass.spread, 256 - 4 * grass.spread, 256 - 4 * grass.spread};
+  v4i share = {grass.spread, grass.spread, grass.spread, grass.spread};
+
+  for (int row = first; row < last; row++) {
+    int32_t* m = &grass.mass[(size_t)row * cols];
+    int32_t* up = row > 0 ? m - cols : m;
+    int32_t* down = row < grass.rows - 1 ? m + cols : m;
+    int32_t* out = &grass.next[(size_t)row * cols];
+
+    // Four cells at a time away from the ends of the row
+    int x = 1;
+    for (; x + 4 <= cols - 1; x += 4) {
+      v4i c, l, r, u, d;
+      memcpy(&c, m + x, sizeof(c));
+      memcpy(&l, m + x - 1, sizeof(l));
+      memcpy(&r, m + x + 1, sizeof(r));
+      memcpy(&u, up + x, sizeof(u));
+      memcpy(&d, down + x, sizeof(d));
+      v4i s = (c * keep + (l + r + u + d) * share) >> 8;
+      memcpy(out + x, &s, sizeof(s));
+    }
+    for (; x < cols - 1; x++) {
+      out[x] = spreadCell(m[x], m[x - 1] + m[x + 1] + up[x] + down[x]);
+    }
+    out[0] = spreadCell(m[0], (cols > 1 ? m[1] : m[0]) + m[0] + up[0] + down[0]);
+    if (cols > 1) {
+      out[cols - 1] = spreadCell(m[cols - 1], m[cols - 2] + m[cols - 1] + up[cols - 1] + down[cols - 1]);
+    }
+  }
+}
+
+// Grow our rows by what the plant season gives the whole world every frame
+void growField(double plantsPerFrame) {
+  grass.owed += plantsPerFrame * cfg.dt * FIELD_UNIT / ((double)grass.cols * grass.rows);
+  grass.growth = (int32_t)grass.owed;
+  grass.owed -= grass.growth;
+  runTasks(&growBand, 0, bandsOf(grass.firstRow, grass.lastRow));
+}
+
+// Spread our rows, and the rows around them as far as they are up to date,
+// so our creatures see the same field however many processes there are
+void spreadField() {
+  grass.spreadFirst = std::max(0, grass.firstRow - grass.halo + 1);
+  grass.spreadLast = std::min(grass.rows, grass.lastRow + grass.halo - 1);
+  if (grass.halo == 0) {
+    grass.spreadFirst = grass.firstRow;
+    grass.spreadLast = grass.lastRow;
+  }
+  runTasks(&spreadBand, 0, bandsOf(grass.spreadFirst, grass.spreadLast));
+  grass.mass.swap(grass.next);
+}
+
+// Add up the biomass of the rows this process grows
+int64_t fieldMass() {
+  int64_t total = 0;
+  for (size_t i = (size_t)grass.firstRow * grass.cols; i < (size_t)grass.lastRow * grass.cols; i++) {
+    total += grass.mass[i];
+  }
+  return total;
+}
+
+#endif
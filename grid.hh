@@ -0,0 +1,86 @@
+/* grid.hh sorts entities into square cells covering the world, so that a   *
+ * creature only has to look at entities in the cells around it.           */
+
+#if !defined(GRID_HH)
+#define GRID_HH
+
+#include <vector>
+
+#include "vec2d.hh"
+
+#define GRID_CELL 128 // Width of a grid cell in world units
+
+template<typename T>
+class spatialGrid {
+public:
+  // Sort the entities into cells covering the area from (x0,y0) to (x1,y1).
+  // The grid holds indices into items, which must not move until the next build
+  void build(std::vector<T*>& items, double x0, double y0, double x1, double y1) {
+    _x0 = x0;
+    _y0 = y0;
+    _cols = (int)((x1 - x0) / GRID_CELL) + 1;
+    _rows = (int)((y1 - y0) / GRID_CELL) + 1;
+    _start.assign(_cols * _rows + 1, 0);
+    _cellOf.resize(items.size());
+    _items.resize(items.size());
+
+    // Count the entities in each cell, then turn the counts into offsets
+    for (int i = 0; i < items.size(); i++) {
+      _cellOf[i] = cell(items[i]->pos());
+      _start[_cellOf[i] + 1]++;
+    }
+    for (int c = 0; c < _cols * _rows; c++) {
+      _start[c + 1] += _start[c];
+    }
+
+    // Place every entity in its cell, in index order
+    std::vector<int> next(_start.begin(), _start.end() - 1);
+    for (int i = 0; i < items.size(); i++) {
+      _items[next[_cellOf[i]]++] = i;
+    }
+  }
+
+  // Call f(index) for every entity in the cells within range of pos
+  template<typename F>
+  void query(vec2d pos, double range, F f) {
+    queryArea(pos.x() - range, pos.y() - range, pos.x() + range, pos.y() + range, f);
+  }
+
+  // Call f(index) for every entity in the cells touching the rectangle from
+  // (left,top) to (right,bottom)
+  template<typename F>
+  void queryArea(double left, double top, double right, double bottom, F f) {
+    int x0 = clampCol((left - _x0) / GRID_CELL);
+    int x1 = clampCol((right - _x0) / GRID_CELL);
+    int y0 = clampRow((top - _y0) / GRID_CELL);
+    int y1 = clampRow((bottom - _y0) / GRID_CELL);
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        int c = y * _cols + x;
+        for (int k = _start[c]; k < _start[c + 1]; k++) {
+          f(_items[k]);
+        }
+      }
+    }
+  }
+
+private:
+  // Anything not inside, even a position that isn't a number, goes to the edge
+  int clampCol(double x) { return !(x >= 0) ? 0 : (x >= _cols ? _cols - 1 : (int)x); }
+  int clampRow(double y) { return !(y >= 0) ? 0 : (y >= _rows ? _rows - 1 : (int)y); }
+
+  // Get the cell holding a position. Entities outside the area go to its edge
+  int cell(vec2d pos) {
+    return clampRow((pos.y() - _y0) / GRID_CELL) * _cols + clampCol((pos.x() - _x0) / GRID_CELL);
+  }
+
+  double _x0 = 0;
+  double _y0 = 0;
+  int _cols = 0;
+  int _rows = 0;
+  std::vector<int> _start;  // Where each cell's entities start in _items
+  std::vector<int> _items;  // Entity indices, sorted by cell
+  std::vector<int> _cellOf; // The cell of each entity
+};
+
+#endif
@@ -83,7 +83,9 @@ public:
   }
   
   /**
-   * Display a bitmap at a specific location on the screen
+   * Display a bitmap at a specific location on the screen. Only the tiles
+   * of the bitmap that changed since it was last displayed are uploaded;
+   * the texture keeps the rest
    * \param bmp     The bitmap to display
    * \param xstart  The horizontal position where bmp should be displayed
    * \param ystart  The vertical position wher ebmp should be displayed
@@ -91,14 +93,12 @@ public:
    * \param height  The height of the area where bmp should be displayed
    */
   void display(bitmap& bmp, int xstart, int ystart, int width, int height) {
-    uint32_t* data;
-    int pitch;
-  
-    SDL_LockTexture(_texture, NULL, (void**)&data, &pitch);
-  
-    bmp.copy_to(data);
-  
-    SDL_UnlockTexture(_texture);
+    int pitch = bmp.width() * sizeof(rgb32);
+    bmp.takeChanged([&](int x, int y, int w, int h) {
+      SDL_Rect area = { x, y, w, h };
+      SDL_UpdateTexture(_texture, &area, bmp.data() + y * bmp.width() + x, pitch);
+    });
+
     SDL_Rect destination = { 0, 0, (int)_width, (int)_height };
     SDL_RenderCopy(_renderer, _texture, NULL, &destination);
     SDL_RenderPresent(_renderer);
@@ -112,6 +112,14 @@ public:
     display(bmp, 0, 0, _width, _height);
   }
   
+  /**
+   * Change the name displayed at the top of the window
+   * \param name    The new name
+   */
+  void setTitle(const char* name) {
+    SDL_SetWindowTitle(_window, name);
+  }
+  
 private:
   size_t _width;
   size_t _height;
@@ -0,0 +1,88 @@
+/* histogram.hh counts how long things take. Buckets get wider with the     *
+ * times they hold, four to every doubling, so one histogram is good to a   *
+ * few percent from a microsecond to an hour.                               */
+
+#if !defined(HISTOGRAM_HH)
+#define HISTOGRAM_HH
+
+#include <cmath>
+#include <cstdio>
+
+#define HISTOGRAM_BUCKETS 128
+#define HISTOGRAM_MIN 0.001 // Milliseconds, the top of the first bucket
+
+typedef struct histogram {
+  long counts[HISTOGRAM_BUCKETS] = {};
+  long total = 0;
+  double max = 0;
+} histogram_t;
+
+// Get the bucket a time in milliseconds goes in
+int bucketOf(double ms) {
+  if (!(ms >= HISTOGRAM_MIN)) {
+    return 0;
+  }
+  int b = 1 + (int)(4 * log2(ms / HISTOGRAM_MIN));
+  return b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1;
+}
+
+// Get the time at the top of a bucket
+double bucketTop(int b) {
+  return HISTOGRAM_MIN * pow(2, b / 4.0);
+}
+
+// Count one time in milliseconds
+void record(histogram_t& h, double ms) {
+  h.counts[bucketOf(ms)]++;
+  h.total++;
+  if (ms > h.max) {
+    h.max = ms;
+  }
+}
+
+// Get a time that a fraction q of the counted times are under, to the top
+// of its bucket
+double percentile(histogram_t& h, double q) {
+  long seen = 0;
+  for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    seen += h.counts[b];
+    if (seen > 0 && seen >= q * h.total) {
+      return fmin(bucketTop(b), h.max);
+    }
+  }
+  return h.max;
+}
+
+// Get the fraction of the counted times at or under a time, to a bucket
+double fractionUnder(histogram_t& h, double ms) {
+  long under = 0;
+  for (int b = 0; b <= bucketOf(ms); b++) {
+    under += h.counts[b];
+  }
+  return h.total > 0 ? (double)under / h.total : 1;
+}
+
+// Print the buckets that counted anything, with a bar for each
+void printHistogram(histogram_t& h, FILE* f, const char* title) {
+  fprintf(f, "%s: %ld samples, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", title,
+          h.total, percentile(h, 0.5), percentile(h, 0.99), h.max);
+  long most = 1;
+  for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    if (h.counts[b] > most) most = h.counts[b];
+  }
+  long seen = 0;
+  for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    if (h.counts[b] == 0) {
+      continue;
+    }
+    seen += h.counts[b];
+    char bar[51];
+    int len = (int)(50 * h.counts[b] / most);
+    for (int i = 0; i < len; i++) bar[i] = '#';
+    bar[len] = '\0';
+    fprintf(f, "  <= %9.3f ms %8ld %5.1f%% %s\n", bucketTop(b), h.counts[b],
+            100.0 * seen / h.total, bar);
+  }
+}
+
+#endif
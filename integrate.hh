@@ -0,0 +1,83 @@
+/* integrate.hh moves creatures branch free, both coordinates of a vector   *
+ * at once in one SIMD register (GCC/clang vector extensions, so SSE2 or    *
+ * NEON without extra compiler flags). A region's creatures are packed in   *
+ * memory (see storage.hh) with what moves at the start of each, so moving  *
+ * them all streams through memory. Collisions are found along the whole    *
+ * step, not just where it ends, so long steps don't pass through things.   */
+
+#if !defined(INTEGRATE_HH)
+#define INTEGRATE_HH
+
+#include <cmath>
+#include <stdint.h>
+
+#include "vec2d.hh"
+
+// Two doubles, and the same bits as two integers
+typedef double v2d __attribute__((vector_size(16)));
+typedef int64_t v2i __attribute__((vector_size(16)));
+
+// Get a vector into a register
+v2d load2(vec2d v) {
+  v2d r = {v.x(), v.y()};
+  return r;
+}
+
+// Get a vector out of a register
+vec2d store2(v2d v) {
+  return vec2d(v[0], v[1]);
+}
+
+// Get a vector at length 1, or the zero vector as it is
+vec2d unit(vec2d v) {
+  v2d r = load2(v);
+  v2d sq = r * r;
+  double len2 = sq[0] + sq[1];
+  return len2 > 0 ? store2(r * (1 / sqrt(len2))) : v;
+}
+
+// Bounce a heading of length 1 off the walls of a world reaching from 0 to
+// walls, move the position along it by speed, and burn metabolism off energy,
+// never below 0. Returns true if that starved the creature
+bool integrate(vec2d& pos, vec2d& vel, double speed, double radius,
+               double& energy, double metabolism, v2d walls) {
+  v2d zero = {0, 0};
+  v2d r = {radius, radius};
+  v2i sign = (v2i)(v2d){-0.0, -0.0}; // Only the sign bits set
+  v2d p = load2(pos);
+  v2d v = load2(vel);
+
+  // Over a wall and still heading out: flip that part of the heading
+  v2i out = ((v2i)(p - r < zero) & (v2i)(v < zero)) | ((v2i)(p + r > walls) & (v2i)(v > zero));
+  v = (v2d)((v2i)v ^ (out & sign));
+
+  pos = store2(p + v * speed);
+  vel = store2(v);
+
+  energy -= metabolism;
+  energy = energy > 0 ? energy : 0;
+  return energy <= 0;
+}
+
+// Get how far through a step two circles first come within reach of each
+// other, from 0 to 1, or -1 if they don't. gap is from one to the other at
+// the start of the step, and changes by closing over the step
+double timeOfImpact(vec2d gap, vec2d closing, double reach) {
+  double c = gap * gap - reach * reach;
+  if (c <= 0) {
+    return 0; // Already touching
+  }
+  double b = gap * closing;
+  double a = closing * closing;
+  if (b >= 0 || a == 0) {
+    return -1; // Not getting closer
+  }
+  double disc = b * b - a * c;
+  if (disc < 0) {
+    return -1; // Passing by
+  }
+  double t = (-b - sqrt(disc)) / a;
+  return t <= 1 ? t : -1;
+}
+
+#endif
@@ -0,0 +1,310 @@
+/* islands.hh runs several worlds at once (--islands=M), each in a process  *
+ * of its own with its own seed, threads and telemetry, to watch separate   *
+ * populations drift apart. Every --migrate-every ticks each island sends   *
+ * --migrate-fraction of its creatures to the next island (--topology=ring) *
+ * or to any other (random), through rings in shared memory like those of  *
+ * shard.hh. The first island has the window and the others run headless,  *
+ * held back by the migrations and never ahead of the first; when it stops, *
+ * they all stop at the same tick, and it prints a summary of every island. */
+
+#if !defined(ISLANDS_HH)
+#define ISLANDS_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <signal.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "lineage.hh"
+#include "neighbours.hh"
+#include "random.hh"
+#include "shard.hh"
+#include "world.hh"
+
+// Creatures of island N are numbered from N << ISLAND_ID_SHIFT, so numbers
+// stay apart when they move between islands
+#define ISLAND_ID_SHIFT 48
+
+// How an island is doing, for the summary
+typedef struct islandStats {
+  long ticks;
+  long creatures[2]; // Herbivores and carnivores alive
+  long born;
+  long emigrants;
+  long immigrants;
+} islandStats_t;
+
+// This island, and how many there are
+int islandRank = 0;
+int islandCount = 1;
+
+// Memory every island shares: whether the first has stopped, the tick it
+// is at, every island's stats, and a ring from each island to each other
+std::atomic<bool>* islandsStopping;
+std::atomic<long>* islandsAt;
+islandStats_t* islandStats;
+ring_t* islandRings;
+
+// The other islands, started by the first one
+std::vector<pid_t> islandPids;
+
+// The ring from one island to another
+ring_t* islandRing(int from, int to) {
+  return &islandRings[from * islandCount + to];
+}
+
+// Give an output file of island N the name FILE.N
+void islandFile(std::string& path) {
+  if (!path.empty()) {
+    path += "." + std::to_string(islandRank);
+  }
+}
+
+// Give another island its own capture: run.y4m becomes run.1.y4m, to stay
+// a Y4M video, and a "|command" finds the island in $EVO_ISLAND
+void islandCapture(std::string& path) {
+  if (path.empty() || path[0] == '|') {
+    return;
+  }
+  size_t end = path.size();
+  if (end >= 4 && path.compare(end - 4, 4, ".y4m") == 0) {
+    end -= 4;
+  }
+  path.insert(end, "." + std::to_string(islandRank));
+}
+
+// Share memory for the islands, then fork the other islands. Each returns
+// from here with its own rank, seed and creature numbers, before the world
+// is made
+void startIslands() {
+  islandCount = cfg.islands;
+  if (islandCount <= 1) {
+    return;
+  }
+  size_t statsBytes = sizeof(islandStats_t) * islandCount;
+  size_t bytes = sizeof(ring_t) * islandCount * islandCount + statsBytes + sizeof(std::atomic<long>) +
+    sizeof(std::atomic<bool>);
+  char* mem = (char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("Failed to map shared memory");
+    exit(1);
+  }
+  islandRings = (ring_t*)mem;
+  islandStats = (islandStats_t*)(mem + sizeof(ring_t) * islandCount * islandCount);
+  islandsAt = (std::atomic<long>*)(mem + sizeof(ring_t) * islandCount * islandCount + statsBytes);
+  islandsStopping = (std::atomic<bool>*)(mem + bytes - sizeof(std::atomic<bool>));
+
+  pid_t parent = getpid();
+  setenv("EVO_ISLAND", "0", 1);
+  for (int i = 1; i < islandCount; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("Failed to start an island");
+      exit(1);
+    }
+    if (pid == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      if (getppid() != parent) {
+        exit(1);
+      }
+      islandRank = i;
+      islandPids.clear();
+
+      // Only the first island has the window and what goes with it, but
+      // the others can capture what they would show
+      cfg.seed += islandRank;
+      seedRandom(cfg.seed);
+      lastId = (uint64_t)islandRank << ISLAND_ID_SHIFT;
+      setenv("EVO_ISLAND", std::to_string(islandRank).c_str(), 1);
+      islandFile(cfg.dataFile);
+      islandFile(cfg.lineage);
+      islandFile(cfg.traits);
+      islandCapture(cfg.capture);
+      cfg.metrics = cfg.stream = "";
+      return;
+    }
+    islandPids.push_back(pid);
+  }
+}
+
+// Is the first island still running
+bool islandsRunning() {
+  return !islandsStopping->load(std::memory_order_acquire);
+}
+
+// Wait until another island may run some ticks, and get how many: up to
+// the tick the first island is at, and no further than the next migration.
+// None once the first has stopped and this one caught up with it
+int islandTicks(int tick) {
+  while (true) {
+    bool stopping = !islandsRunning();
+    long ticks = islandsAt->load(std::memory_order_acquire) - tick;
+    if (cfg.migrateEvery > 0) {
+      ticks = std::min(ticks, (long)(cfg.migrateEvery - tick % cfg.migrateEvery));
+    }
+    if (ticks > 0 || stopping) {
+      return (int)std::max(ticks, 0L);
+    }
+    usleep(500);
+  }
+}
+
+// Get how many more creatures this island sent away than it took in
+long islandEmigrants() {
+  if (islandCount <= 1) {
+    return 0;
+  }
+  return islandStats[islandRank].emigrants - islandStats[islandRank].immigrants;
+}
+
+// Send out[p] to and receive in[p] from every other island at once, like
+// exchange() does between processes. Returns false if the first island
+// stopped before it was done
+bool islandExchange(std::vector<message>& out, std::vector<message>& in) {
+  std::vector<bool> sent(islandCount, false);
+  std::vector<bool> got(islandCount, false);
+  in.resize(islandCount);
+  for (int p = 0; p < islandCount; p++) {
+    in[p].clear();
+  }
+
+  int left = 2 * (islandCount - 1);
+  while (left > 0) {
+    for (int p = 0; p < islandCount; p++) {
+      if (p == islandRank) {
+        continue;
+      }
+      if (!sent[p] && out[p].sendSome(islandRing(islandRank, p))) {
+        sent[p] = true;
+        --left;
+      }
+      if (!got[p] && in[p].receiveSome(islandRing(p, islandRank))) {
+        got[p] = true;
+        --left;
+      }
+    }
+    if (left > 0) {
+      if (islandRank > 0 && !islandsRunning()) {
+        return false;
+      }
+      sched_yield();
+    }
+  }
+  return true;
+}
+
+// After each tick, let the other islands know how far the first got. After
+// some ticks, send some creatures to other islands and take in the ones they
+// sent. The creatures sending leave only once the others have them
+void migrateIslands(int tick) {
+  if (islandCount <= 1) {
+    return;
+  }
+  if (islandRank == 0) {
+    islandsAt->store(tick, std::memory_order_release);
+  }
+  if (cfg.migrateEvery == 0 || tick % cfg.migrateEvery != 0) {
+    return;
+  }
+  std::vector<message> out(islandCount), in;
+  std::vector<std::vector<bool> > leaving(lastRegion - firstRegion);
+  islandStats_t& mine = islandStats[islandRank];
+  int threshold = (int)(cfg.migrateFraction * 2147483647.0);
+  bool ring = cfg.topology == "ring";
+  for (int r = firstRegion; r < lastRegion; r++) {
+    std::vector<creature*>& creatures = regions[r].creatures;
+    std::vector<bool>& leaves = leaving[r - firstRegion];
+    leaves.assign(creatures.size(), false);
+    for (int i = 0; i < creatures.size(); i++) {
+      if (simRand() >= threshold) {
+        continue;
+      }
+      int to = ring ? islandRank + 1 : islandRank + 1 + simRand() % (islandCount - 1);
+      out[to % islandCount].put(creatures[i]->state());
+      leaves[i] = true;
+    }
+  }
+
+  if (!islandExchange(out, in)) {
+    return;
+  }
+  for (int r = firstRegion; r < lastRegion; r++) {
+    std::vector<creature*>& creatures = regions[r].creatures;
+    std::vector<bool>& leaves = leaving[r - firstRegion];
+    std::vector<int> keptAs(creatures.size(), -1);
+    int kept = 0;
+    for (int i = 0; i < creatures.size(); i++) {
+      if (leaves[i]) {
+        delete creatures[i];
+        ++mine.emigrants;
+        continue;
+      }
+      keptAs[i] = kept;
+      creatures[kept++] = creatures[i];
+    }
+    creatures.resize(kept);
+    renumberNeighbours(regions[r], keptAs);
+  }
+  for (int p = 0; p < islandCount; p++) {
+    while (p != islandRank && !in[p].done()) {
+      addCreature(new creature(in[p].get<creatureState_t>()));
+      ++mine.immigrants;
+    }
+  }
+}
+
+// Note how this island ended up. The first island stops the others, waits
+// for them and prints how each did
+void stopIslands(int tick) {
+  if (islandCount <= 1) {
+    return;
+  }
+  islandStats_t& mine = islandStats[islandRank];
+  mine.ticks = tick;
+  mine.creatures[0] = mine.creatures[1] = 0;
+  for (int r = firstRegion; r < lastRegion; r++) {
+    for (int i = 0; i < regions[r].creatures.size(); i++) {
+      ++mine.creatures[regions[r].creatures[i]->food_source()];
+    }
+  }
+  mine.born = (long)(lastId & ((1ULL << ISLAND_ID_SHIFT) - 1)) - cfg.herbivores - cfg.carnivores;
+  if (islandRank > 0) {
+    return;
+  }
+
+  islandsStopping->store(true, std::memory_order_release);
+  for (int i = 0; i < islandPids.size(); i++) {
+    waitpid(islandPids[i], NULL, 0);
+  }
+  islandStats_t all = islandStats_t();
+  printf("Island   Ticks  Herbivores  Carnivores      Born  Emigrants  Immigrants\n");
+  for (int i = 0; i <= islandCount; i++) {
+    islandStats_t& s = i < islandCount ? islandStats[i] : all;
+    if (i < islandCount) {
+      printf("%6d", i);
+      all.ticks += s.ticks;
+      all.creatures[0] += s.creatures[0];
+      all.creatures[1] += s.creatures[1];
+      all.born += s.born;
+      all.emigrants += s.emigrants;
+      all.immigrants += s.immigrants;
+    }
+    else {
+      printf("%6s", "All");
+    }
+    printf(" %7ld %11ld %11ld %9ld %10ld %11ld\n", s.ticks, s.creatures[0], s.creatures[1],
+           s.born, s.emigrants, s.immigrants);
+  }
+}
+
+#endif
@@ -0,0 +1,180 @@
+/* lineage.hh logs who descends from whom (--lineage=FILE). Every creature  *
+ * gets a number when it is born, given out in the same order however many *
+ * processes there are. Each birth (number, parents, tick, genome) and each *
+ * death (number, tick, cause) is one fixed-size record, added to a block  *
+ * in memory; full blocks are handed to a writer thread (see handOff in    *
+ * threads.hh) to append to the log. tools/lineage reads it back.          */
+
+#if !defined(LINEAGE_HH)
+#define LINEAGE_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "config.hh"
+#include "threads.hh"
+
+#define LINEAGE_MAGIC "EVOLIN1" // Starts every log, with its NUL making 8 bytes
+#define LINEAGE_BLOCK 4096      // Records written out at once
+
+// Kinds of records
+#define LINEAGE_BIRTH 0
+#define LINEAGE_DEATH 1
+
+// Causes of death
+#define DEATH_STARVED 0
+#define DEATH_EATEN 1
+
+// One birth or death, as it is stored in the log
+typedef struct lineageRecord {
+  uint64_t id;
+  uint64_t parents[2]; // 0 for the first creatures, and for deaths
+  uint64_t genome;
+  uint32_t tick;
+  uint8_t kind;        // LINEAGE_BIRTH or LINEAGE_DEATH
+  uint8_t food;        // HERBIVORE or CARNIVORE
+  uint8_t cause;       // DEATH_STARVED or DEATH_EATEN, for deaths
+  uint8_t unused;
+} lineageRecord_t;
+
+typedef std::vector<lineageRecord_t> lineageBlock_t;
+
+typedef struct lineage {
+  bool on;
+  FILE* out;
+  std::string path;
+
+  // The block being filled, and the writer of full ones
+  lineageBlock_t* block;
+  handOff<lineageBlock_t> writer;
+
+  // Deaths in each region this tick, kept apart while the regions are
+  // buried at once and logged in region order after
+  std::vector<lineageBlock_t> deaths;
+
+  long births, died;
+} lineage_t;
+
+lineage_t lineageLog;
+
+// The last number given to a creature. It goes along with the border pass,
+// like the random numbers, so babies are numbered in the same order anywhere
+uint64_t lastId = 0;
+
+// Get the number of a new creature
+uint64_t newId() { return ++lastId; }
+
+// Write a full block to the log
+void writeBlock(int tick, lineageBlock_t& b) {
+  if (!b.empty()) {
+    fwrite(&b[0], sizeof(lineageRecord_t), b.size(), lineageLog.out);
+  }
+  b.clear();
+}
+
+// Hand the block being filled to the writer, and start another. The log
+// must be complete, so a new block is made if none is free
+void passBlock() {
+  handOver(lineageLog.writer, 0, lineageLog.block);
+  lineageLog.block = takeSpare(lineageLog.writer, false);
+  if (lineageLog.block == NULL) {
+    lineageLog.block = new lineageBlock_t();
+    lineageLog.block->reserve(LINEAGE_BLOCK);
+  }
+}
+
+// Add a record to the log
+void logRecord(const lineageRecord_t& rec) {
+  lineageLog.block->push_back(rec);
+  if (lineageLog.block->size() == LINEAGE_BLOCK) {
+    passBlock();
+  }
+}
+
+// Fill in a record of a creature
+lineageRecord_t makeRecord(int kind, uint64_t id, uint32_t tick, int food, uint64_t genome) {
+  lineageRecord_t rec = lineageRecord_t();
+  rec.id = id;
+  rec.genome = genome;
+  rec.tick = tick;
+  rec.kind = kind;
+  rec.food = food;
+  return rec;
+}
+
+// Log the birth of a creature, to parents numbered 0 for the first creatures
+void logBirth(uint64_t id, uint64_t parent1, uint64_t parent2, uint32_t tick, int food, uint64_t genome) {
+  if (!lineageLog.on) {
+    return;
+  }
+  lineageRecord_t rec = makeRecord(LINEAGE_BIRTH, id, tick, food, genome);
+  rec.parents[0] = parent1;
+  rec.parents[1] = parent2;
+  logRecord(rec);
+  ++lineageLog.births;
+}
+
+// Note the death of a creature of a region, for logDeaths
+void noteDeath(int r, uint64_t id, uint32_t tick, int food, uint64_t genome, int cause) {
+  if (!lineageLog.on) {
+    return;
+  }
+  lineageRecord_t rec = makeRecord(LINEAGE_DEATH, id, tick, food, genome);
+  rec.cause = cause;
+  lineageLog.deaths[r].push_back(rec);
+}
+
+// Log the deaths noted in some regions, in region order
+void logDeaths(int first, int last) {
+  if (!lineageLog.on) {
+    return;
+  }
+  for (int r = first; r < last; r++) {
+    for (size_t i = 0; i < lineageLog.deaths[r].size(); i++) {
+      logRecord(lineageLog.deaths[r][i]);
+    }
+    lineageLog.died += lineageLog.deaths[r].size();
+    lineageLog.deaths[r].clear();
+  }
+}
+
+// Open one process's log, if one was asked for, and start writing it. The
+// first process writes FILE, the others FILE.1, FILE.2...
+void startLineage(int process, int regions) {
+  lineageLog.on = !cfg.lineage.empty();
+  if (!lineageLog.on) {
+    return;
+  }
+  lineageLog.path = cfg.lineage;
+  if (process > 0) {
+    lineageLog.path += "." + std::to_string(process);
+  }
+  lineageLog.out = fopen(lineageLog.path.c_str(), "wb");
+  if (lineageLog.out == NULL) {
+    fprintf(stderr, "Failed to open %s for the lineage log\n", lineageLog.path.c_str());
+    exit(1);
+  }
+  fwrite(LINEAGE_MAGIC, 1, sizeof(LINEAGE_MAGIC), lineageLog.out);
+
+  lineageLog.block = new lineageBlock_t();
+  lineageLog.block->reserve(LINEAGE_BLOCK);
+  lineageLog.deaths.resize(regions);
+  lineageLog.births = lineageLog.died = 0;
+  startHandOff(lineageLog.writer, writeBlock);
+}
+
+// Write out what is left of the log and close it
+void stopLineage() {
+  if (!lineageLog.on) {
+    return;
+  }
+  handOver(lineageLog.writer, 0, lineageLog.block);
+  stopHandOff(lineageLog.writer);
+  fclose(lineageLog.out);
+  printf("Logged %ld births and %ld deaths to %s\n", lineageLog.births, lineageLog.died, lineageLog.path.c_str());
+}
+
+#endif
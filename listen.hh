@@ -0,0 +1,87 @@
+/* listen.hh opens the sockets that other programs connect to while a run   *
+ * goes on: on localhost for a port number, or a Unix socket for a path.    */
+
+#if !defined(LISTEN_HH)
+#define LISTEN_HH
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Start listening on a localhost PORT, or a Unix socket at any other PATH,
+// to serve something. A PATH that is there already must be a socket that
+// nothing answers on any more. Returns the socket, and the path to remove
+// when done, or "" for a port
+int listenOn(const std::string& where, const char* what, std::string* path) {
+  int fd;
+  bool port = where.find_first_not_of("0123456789") == std::string::npos;
+  if (port) {
+    struct sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(where.c_str()));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      fprintf(stderr, "Failed to serve %s on port %s\n", what, where.c_str());
+      exit(1);
+    }
+    *path = "";
+  }
+  else {
+    struct sockaddr_un addr = sockaddr_un();
+    addr.sun_family = AF_UNIX;
+    if (where.size() >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "The %s socket path %s is too long\n", what, where.c_str());
+      exit(1);
+    }
+    strcpy(addr.sun_path, where.c_str());
+
+    // A socket left by an earlier run is replaced, but not one still in
+    // use, nor anything else
+    struct stat st;
+    if (lstat(where.c_str(), &st) == 0) {
+      if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "Won't serve %s on %s, it is already there and not a socket\n", what, where.c_str());
+        exit(1);
+      }
+      int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+      bool answered = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+      if (probe >= 0) {
+        close(probe);
+      }
+      if (answered) {
+        fprintf(stderr, "Won't serve %s on %s, something is already listening there\n", what, where.c_str());
+        exit(1);
+      }
+      unlink(where.c_str());
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      fprintf(stderr, "Failed to serve %s on %s\n", what, where.c_str());
+      exit(1);
+    }
+    *path = where;
+  }
+  listen(fd, 16);
+  return fd;
+}
+
+// Stop listening, and remove a Unix socket
+void stopListening(int fd, const std::string& path) {
+  shutdown(fd, SHUT_RDWR);
+  close(fd);
+  if (!path.empty()) {
+    unlink(path.c_str());
+  }
+}
+
+#endif
@@ -0,0 +1,145 @@
+/* mates.hh groups creatures that are ready to reproduce by area of the    *
+ * world and genome, so that a creature only looks at nearby buddies that  *
+ * could possibly be the same species.                                     */
+
+#if !defined(MATES_HH)
+#define MATES_HH
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "creature.hh"
+
+// The species bits are split into SPECIES_DISTANCE blocks. Two creatures
+// differing in fewer than SPECIES_DISTANCE bits must agree exactly on at
+// least one block, so each creature is filed once per block under that
+// block's value and only those buckets need to be searched. Areas are as
+// wide as the longest mating distance, so only the 3x3 areas around a
+// creature can hold its buddy. A creature is in up to 8 buckets but is only
+// a candidate in the first one it shares with the one looking, so entries
+// keep the genome and position, to pass over the others without touching
+// the creature.
+#define MATE_BLOCKS SPECIES_DISTANCE
+#define MATE_BLOCK_BITS 4
+#define MATE_BLOCK_VALUES (1 << MATE_BLOCK_BITS)
+#define MATE_FIRST_BIT 8 // The species bits start after the color trait
+
+static_assert(MATE_BLOCKS * MATE_BLOCK_BITS == 32,
+              "Mate index blocks must cover the species bits");
+
+// A creature filed in a bucket, with what picking a buddy needs. Creatures
+// don't move while buddies are being found
+typedef struct mateEntry {
+  uint64_t genome;
+  vec2d pos;
+  creature* c;
+} mateEntry_t;
+
+class mateIndex {
+public:
+  // Forget all creatures from the last tick, and buckets nobody used then
+  void clear() {
+    std::unordered_map<uint64_t, std::vector<mateEntry_t> >::iterator it = _buckets.begin();
+    while (it != _buckets.end()) {
+      if (it->second.empty()) {
+        it = _buckets.erase(it);
+      }
+      else {
+        it->second.clear();
+        ++it;
+      }
+    }
+    // A creature never looks for a buddy further away than this
+    _cellSize = 2 * (255 + cfg.maxRadius);
+  }
+
+  // File a creature under each of its blocks if it has the energy to reproduce
+  void add(creature* c) {
+    if (!c->readyToMate()) {
+      return;
+    }
+    mateEntry_t entry = { c->genome(), c->pos(), c };
+    int cx = cellOf(entry.pos.x());
+    int cy = cellOf(entry.pos.y());
+    for (int b = 0; b < MATE_BLOCKS; b++) {
+      _buckets[key(c->food_source(), b, block(entry.genome, b), cx, cy)].push_back(entry);
+    }
+  }
+
+  // Find the nearest buddy of the same diet and species within maxDist
+  creature* nearest(creature* c, double maxDist) {
+    creature* closest = NULL;
+    double minDist = maxDist;
+    uint64_t g = c->genome();
+    vec2d cPos = c->pos();
+    int cx = cellOf(cPos.x());
+    int cy = cellOf(cPos.y());
+
+    for (int b = 0; b < MATE_BLOCKS; b++) {
+      // Buddies are at most one cell away
+      for (int y = cy - 1; y <= cy + 1; y++) {
+        for (int x = cx - 1; x <= cx + 1; x++) {
+          if (x < 0 || y < 0) {
+            continue;
+          }
+          std::unordered_map<uint64_t, std::vector<mateEntry_t> >::iterator it =
+            _buckets.find(key(c->food_source(), b, block(g, b), x, y));
+          if (it == _buckets.end()) {
+            continue;
+          }
+
+          std::vector<mateEntry_t>& bucket = it->second;
+          for (int i = 0; i < bucket.size(); i++) {
+            mateEntry_t& buddy = bucket[i];
+
+            // Only look at each buddy from the first block it shares with us
+            uint64_t diff = (g ^ buddy.genome) & SPECIES_MASK;
+            if (firstSharedBlock(diff) != b ||
+                __builtin_popcountll(diff) >= SPECIES_DISTANCE || buddy.c == c) {
+              continue;
+            }
+
+            vec2d bPos = buddy.pos;
+            double dx = bPos.x() - cPos.x();
+            double dy = bPos.y() - cPos.y();
+            double dist = sqrt(dx*dx + dy*dy);
+            if (dist != 0 && dist < minDist) { // Make sure our buddy is not on top of us
+              minDist = dist;
+              closest = buddy.c;
+            }
+          }
+        }
+      }
+    }
+    return closest;
+  }
+
+private:
+  // Get the value of one block of a genome's species bits
+  static int block(uint64_t genome, int b) {
+    return (genome >> (MATE_FIRST_BIT + b * MATE_BLOCK_BITS)) & (MATE_BLOCK_VALUES - 1);
+  }
+
+  // Get the index of the first block where the difference is all zeros
+  static int firstSharedBlock(uint64_t diff) {
+    uint32_t t = (uint32_t)(diff >> MATE_FIRST_BIT);
+    uint32_t nonzero = (t | (t >> 1) | (t >> 2) | (t >> 3)) & 0x11111111;
+    uint32_t zero = ~nonzero & 0x11111111;
+    return zero == 0 ? MATE_BLOCKS : __builtin_ctz(zero) / MATE_BLOCK_BITS;
+  }
+
+  // Get the column or row of the area holding a coordinate
+  int cellOf(double v) { return v < 0 ? 0 : (int)(v / _cellSize); }
+
+  // Bucket key: diet, block and block value, then the area of the world
+  static uint64_t key(int diet, int b, int value, int cx, int cy) {
+    return (uint64_t)diet | (uint64_t)b << 1 | (uint64_t)value << 4 |
+      (uint64_t)cx << 8 | (uint64_t)cy << 36;
+  }
+
+  double _cellSize = 1;
+  std::unordered_map<uint64_t, std::vector<mateEntry_t> > _buckets;
+};
+
+#endif
@@ -0,0 +1,257 @@
+/* metrics.hh serves the state of a run to Prometheus, or anything else     *
+ * that speaks its text format (--metrics=PORT on localhost, or             *
+ * --metrics=PATH for a Unix socket). The simulation only stores numbers    *
+ * into atomics as it goes; a thread of its own answers each scrape from    *
+ * them, so scraping never holds the simulation up. The first process      *
+ * serves the totals of every process and its own tick phases and memory.  */
+
+#if !defined(METRICS_HH)
+#define METRICS_HH
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.hh"
+#include "listen.hh"
+#include "threads.hh"
+
+// Phases of a tick, timed one after another
+#define PHASE_BORDERS 0     // Finding borders and gathering ghosts
+#define PHASE_PERCEIVE 1    // Perceiving and reacting
+#define PHASE_MOVE 2
+#define PHASE_COLLIDE 3     // Collisions and grazing inside regions
+#define PHASE_BORDER_PASS 4 // Collisions across edges and mating, process by process
+#define PHASE_MIGRATE 5     // Burying the dead and moving creatures between regions
+#define PHASE_PLANTS 6
+#define PHASES 7
+
+const char* phaseNames[PHASES] = {
+  "borders", "perceive", "move", "collide", "border_pass", "migrate", "plants"
+};
+
+typedef struct metrics {
+  bool on;
+  int listener;       // Socket taking scrapes
+  std::string path;   // Of a Unix socket, to remove when done
+  std::thread server;
+
+  // Stored by the simulation, read by the server whenever it is scraped
+  std::atomic<long> ticks;
+  std::atomic<long> creatures[2];       // Herbivores and carnivores alive
+  std::atomic<long> plants;
+  std::atomic<long> born;               // Since the first creatures
+  std::atomic<long> died;
+  std::atomic<double> bornPerSecond;    // Over the last second or so
+  std::atomic<double> diedPerSecond;
+  std::atomic<double> phaseSeconds[PHASES]; // Spent in each phase so far
+  std::atomic<double> frameMs[3];       // p50, p99 and max time between frames
+  std::atomic<long> overruns;           // Frames that ended after their deadline
+  std::atomic<long> dropped;            // Frames skipped to catch up
+
+  // Where the simulation has got to, for timing phases and rates
+  double phaseStart;
+  double rateStart;
+  long rateBorn, rateDied;
+} metrics_t;
+
+metrics_t meters;
+
+// Get the time in seconds, for timing phases
+double metricsClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Start timing the phases of a tick
+void startPhases() {
+  if (meters.on) {
+    meters.phaseStart = metricsClock();
+  }
+}
+
+// Add the time since the last phase ended to a phase
+void phaseDone(int phase) {
+  if (!meters.on) {
+    return;
+  }
+  double now = metricsClock();
+  meters.phaseSeconds[phase].store(meters.phaseSeconds[phase].load(std::memory_order_relaxed) +
+                                   now - meters.phaseStart, std::memory_order_relaxed);
+  meters.phaseStart = now;
+}
+
+// Store the totals over every process after some ticks. Creatures are
+// numbered as they are born, so the last number tells how many there were;
+// the ones that aren't alive either died or left for another island
+void storeTotals(long ticks, long herbivores, long carnivores, long plants, uint64_t lastId, long emigrants) {
+  if (!meters.on) {
+    return;
+  }
+  long first = cfg.herbivores + cfg.carnivores;
+  long born = (long)lastId - first;
+  long died = first + born - emigrants - herbivores - carnivores;
+  meters.ticks.store(ticks, std::memory_order_relaxed);
+  meters.creatures[0].store(herbivores, std::memory_order_relaxed);
+  meters.creatures[1].store(carnivores, std::memory_order_relaxed);
+  meters.plants.store(plants, std::memory_order_relaxed);
+  meters.born.store(born, std::memory_order_relaxed);
+  meters.died.store(died, std::memory_order_relaxed);
+
+  double now = metricsClock();
+  if (now - meters.rateStart >= 1) {
+    meters.bornPerSecond.store((born - meters.rateBorn) / (now - meters.rateStart), std::memory_order_relaxed);
+    meters.diedPerSecond.store((died - meters.rateDied) / (now - meters.rateStart), std::memory_order_relaxed);
+    meters.rateStart = now;
+    meters.rateBorn = born;
+    meters.rateDied = died;
+  }
+}
+
+// Store how steady the frames are, after each (see pacing.hh)
+void storeFrames(double p50, double p99, double max, long overruns, long dropped) {
+  if (!meters.on) {
+    return;
+  }
+  meters.frameMs[0].store(p50, std::memory_order_relaxed);
+  meters.frameMs[1].store(p99, std::memory_order_relaxed);
+  meters.frameMs[2].store(max, std::memory_order_relaxed);
+  meters.overruns.store(overruns, std::memory_order_relaxed);
+  meters.dropped.store(dropped, std::memory_order_relaxed);
+}
+
+// Add one metric, with its help line, to a scrape
+void addMetric(std::string& out, const char* name, const char* type, const char* help) {
+  char line[256];
+  snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  out += line;
+}
+
+// Add a value of a metric, with labels in braces or "", to a scrape
+void addValue(std::string& out, const char* name, const char* labels, double value) {
+  char line[256];
+  snprintf(line, sizeof(line), "%s%s %.17g\n", name, labels, value);
+  out += line;
+}
+
+// Get the memory this process has in RAM, in bytes
+double residentBytes() {
+  long pages = 0, resident = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(f);
+  }
+  return (double)resident * sysconf(_SC_PAGESIZE);
+}
+
+// Write out every metric as it is now
+std::string scrape() {
+  std::string out;
+  std::memory_order o = std::memory_order_relaxed;
+
+  addMetric(out, "evo_ticks_total", "counter", "Simulation ticks run");
+  addValue(out, "evo_ticks_total", "", meters.ticks.load(o));
+  addMetric(out, "evo_creatures", "gauge", "Creatures alive, by diet");
+  addValue(out, "evo_creatures", "{diet=\"herbivore\"}", meters.creatures[0].load(o));
+  addValue(out, "evo_creatures", "{diet=\"carnivore\"}", meters.creatures[1].load(o));
+  addMetric(out, "evo_plants", "gauge", "Plants, or biomass in plants for a food field");
+  addValue(out, "evo_plants", "", meters.plants.load(o));
+  addMetric(out, "evo_births_total", "counter", "Creatures born since the start");
+  addValue(out, "evo_births_total", "", meters.born.load(o));
+  addMetric(out, "evo_deaths_total", "counter", "Creatures dead since the start");
+  addValue(out, "evo_deaths_total", "", meters.died.load(o));
+  addMetric(out, "evo_births_per_second", "gauge", "Births per second of wall time, over the last second");
+  addValue(out, "evo_births_per_second", "", meters.bornPerSecond.load(o));
+  addMetric(out, "evo_deaths_per_second", "gauge", "Deaths per second of wall time, over the last second");
+  addValue(out, "evo_deaths_per_second", "", meters.diedPerSecond.load(o));
+
+  addMetric(out, "evo_phase_seconds_total", "counter", "Time the first process spent in each phase of a tick");
+  for (int p = 0; p < PHASES; p++) {
+    char labels[64];
+    snprintf(labels, sizeof(labels), "{phase=\"%s\"}", phaseNames[p]);
+    addValue(out, "evo_phase_seconds_total", labels, meters.phaseSeconds[p].load(o));
+  }
+
+  addMetric(out, "evo_frame_seconds", "gauge", "Time from the end of one displayed frame to the end of the next");
+  addValue(out, "evo_frame_seconds", "{quantile=\"0.5\"}", meters.frameMs[0].load(o) / 1000);
+  addValue(out, "evo_frame_seconds", "{quantile=\"0.99\"}", meters.frameMs[1].load(o) / 1000);
+  addValue(out, "evo_frame_seconds", "{quantile=\"1\"}", meters.frameMs[2].load(o) / 1000);
+  addMetric(out, "evo_frame_overruns_total", "counter", "Displayed frames that ended after their deadline");
+  addValue(out, "evo_frame_overruns_total", "", meters.overruns.load(o));
+  addMetric(out, "evo_frames_dropped_total", "counter", "Displayed frames skipped to catch up");
+  addValue(out, "evo_frames_dropped_total", "", meters.dropped.load(o));
+
+  addMetric(out, "evo_task_queue_depth", "gauge", "Tasks waiting for a worker thread of the first process");
+  addValue(out, "evo_task_queue_depth", "", tasksQueued.load(o));
+  addMetric(out, "evo_resident_bytes", "gauge", "Memory of the first process in RAM");
+  addValue(out, "evo_resident_bytes", "", residentBytes());
+  return out;
+}
+
+// Answer scrapes until the socket is shut. Any request gets the metrics
+void serveMetrics() {
+  while (true) {
+    int fd = accept(meters.listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    // Don't let a client that never sends its request hold up the others
+    struct timeval wait = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    char request[4096];
+    recv(fd, request, sizeof(request), 0);
+
+    std::string body = scrape();
+    char header[160];
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %zu\r\n\r\n", body.size());
+    std::string reply = header + body;
+    for (size_t sent = 0; sent < reply.size(); ) {
+      ssize_t n = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    close(fd);
+  }
+}
+
+// Open the socket, if metrics were asked for, and start answering scrapes
+void startMetrics() {
+  meters.on = !cfg.metrics.empty();
+  if (!meters.on) {
+    return;
+  }
+  meters.listener = listenOn(cfg.metrics, "metrics", &meters.path);
+  meters.rateStart = metricsClock();
+  meters.server = std::thread(serveMetrics);
+}
+
+// Stop answering scrapes
+void stopMetrics() {
+  if (!meters.on) {
+    return;
+  }
+  stopListening(meters.listener, meters.path);
+  meters.server.join();
+}
+
+#endif
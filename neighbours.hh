@@ -0,0 +1,140 @@
+/* neighbours.hh keeps a list of the creatures around each creature of a    *
+ * region (a Verlet list). A list reaches past the creature's sight by a    *
+ * skin, so it stays good while creatures move less than the skin, and     *
+ * only a creature that moved more than half the skin since its list was   *
+ * made looks its surroundings up in the grid again. Lists hold indices    *
+ * into the region's creatures, in increasing order, so everyone sees its  *
+ * neighbours in the same order however the lists came about.             */
+
+#if !defined(NEIGHBOURS_HH)
+#define NEIGHBOURS_HH
+
+#include <algorithm>
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "world.hh"
+
+// How far a creature's list reaches. Since two creatures were last checked,
+// one moved at most half the skin and the other at most the whole skin:
+// half before its list was made and half after. Collisions also need those
+// that were close enough to touch while both made their last step
+double listReach(creature* c) {
+  return c->vision() + cfg.maxRadius + 2 * maxStep + 1.5 * cfg.skin;
+}
+
+// Make new lists for the creatures that moved too far or just arrived, and
+// add them to the lists of those around them
+void refreshNeighbours(region_t& reg) {
+  std::vector<creature*>& cs = reg.creatures;
+  int n = cs.size();
+  reg.neighbours.resize(n);
+  reg.listedAt.resize(n);
+
+  std::vector<bool> relist(n, false);
+  bool any = false;
+  double limit = cfg.skin * cfg.skin / 4;
+  for (int i = 0; i < n; i++) {
+    vec2d moved = cs[i]->pos() - reg.listedAt[i];
+    if (i >= reg.listed || moved * moved > limit) {
+      relist[i] = true;
+      any = true;
+    }
+  }
+  reg.listed = n;
+  if (!any) {
+    return;
+  }
+
+  // The furthest any list reaches: the longest sight is 255 past the radius
+  double reach = 255 + 2 * cfg.maxRadius + 2 * maxStep + 1.5 * cfg.skin;
+  reg.grid.build(cs, reg.x0 - ghostBand, reg.y0 - ghostBand, reg.x1 + ghostBand, reg.y1 + ghostBand);
+
+  for (int i = 0; i < n; i++) {
+    if (!relist[i]) {
+      continue;
+    }
+    vec2d pos = cs[i]->pos();
+    double mine = listReach(cs[i]);
+    std::vector<int>& list = reg.neighbours[i];
+    list.clear();
+
+    reg.grid.query(pos, reach, [&](int j) {
+      if (j == i) {
+        return;
+      }
+      vec2d d = cs[j]->pos() - pos;
+      double dist = sqrt(d * d);
+      if (dist <= mine) {
+        list.push_back(j);
+      }
+
+      // Those keeping their list may not have us yet
+      if (!relist[j] && dist <= listReach(cs[j])) {
+        std::vector<int>& theirs = reg.neighbours[j];
+        std::vector<int>::iterator at = std::lower_bound(theirs.begin(), theirs.end(), i);
+        if (at == theirs.end() || *at != i) {
+          theirs.insert(at, i);
+        }
+      }
+    });
+
+    std::sort(list.begin(), list.end());
+    reg.listedAt[i] = pos;
+  }
+}
+
+// Renumber the lists once dead and leaving creatures are gone. keptAs holds
+// the new index of every creature that had a list, or -1
+void renumberNeighbours(region_t& reg, std::vector<int>& keptAs) {
+  int listed = 0;
+  for (int i = 0; i < reg.listed; i++) {
+    if (keptAs[i] >= 0) {
+      reg.neighbours[listed].swap(reg.neighbours[i]);
+      reg.listedAt[listed] = reg.listedAt[i];
+      listed++;
+    }
+  }
+  reg.neighbours.resize(listed);
+  reg.listedAt.resize(listed);
+  reg.listed = listed;
+
+  // Creatures kept their order, so the lists stay sorted
+  for (int i = 0; i < listed; i++) {
+    std::vector<int>& list = reg.neighbours[i];
+    int k = 0;
+    for (int j = 0; j < list.size(); j++) {
+      if (keptAs[list[j]] >= 0) {
+        list[k++] = keptAs[list[j]];
+      }
+    }
+    list.resize(k);
+  }
+}
+
+// Follow the creatures of a region to their new places: the creature at
+// index order[k] moved to k. Every creature must have a list
+void permuteNeighbours(region_t& reg, std::vector<int>& order) {
+  int n = order.size();
+  std::vector<int> movedTo(n);
+  for (int k = 0; k < n; k++) {
+    movedTo[order[k]] = k;
+  }
+
+  std::vector<std::vector<int> > neighbours(n);
+  std::vector<vec2d> listedAt(n);
+  for (int k = 0; k < n; k++) {
+    neighbours[k].swap(reg.neighbours[order[k]]);
+    listedAt[k] = reg.listedAt[order[k]];
+    std::vector<int>& list = neighbours[k];
+    for (int j = 0; j < list.size(); j++) {
+      list[j] = movedTo[list[j]];
+    }
+    std::sort(list.begin(), list.end());
+  }
+  reg.neighbours.swap(neighbours);
+  reg.listedAt.swap(listedAt);
+}
+
+#endif
@@ -0,0 +1,171 @@
+/* pacing.hh keeps the window to --fps frames a second. Each frame has a    *
+ * deadline on the monotonic clock, a whole frame after the last one, and   *
+ * the loop sleeps until it with clock_nanosleep, so sleeps that wake late  *
+ * don't add up. --pace-spin=US sleeps until that many microseconds before  *
+ * the deadline and spins for the rest, for steadier frames at the cost of  *
+ * a core. A frame that ends after its deadline overran; when it is more    *
+ * than a whole frame late, the frames it had no time for are dropped, and  *
+ * the next deadlines follow on from the last one missed. Frame times are   *
+ * counted in bins of 10 microseconds, up to a few frames long, as they     *
+ * vary far less than histogram.hh's buckets are wide. Longer frames go in  *
+ * a histogram_t as well, so the tail is measured however long it gets.     */
+
+#if !defined(PACING_HH)
+#define PACING_HH
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include "config.hh"
+#include "histogram.hh"
+#include "metrics.hh"
+
+#define FRAME_BIN_US 10     // Width of a bin of frame times, in microseconds
+#define FRAME_BIN_PERIODS 4 // Frames this many periods long or longer share the last bin, and the tail
+#define FRAME_PRINT_ROWS 40 // Most rows printed of the frame times
+
+// How long frames took, from the end of one to the end of the next
+typedef struct frameTimes {
+  std::vector<long> counts; // By bin
+  histogram_t tail;         // The frames in the last bin
+  long total;
+  double max;               // Milliseconds
+} frameTimes_t;
+
+typedef struct pacer {
+  int64_t deadline; // When the frame being run should end, in nanoseconds
+  int64_t lastEnd;  // When the last frame ended
+  frameTimes_t frameTimes;
+  long overruns;    // Frames that ended after their deadline
+  long dropped;     // Frames skipped to catch up
+} pacer_t;
+
+pacer_t pacing;
+
+// Get the monotonic clock in nanoseconds
+int64_t paceClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Sleep until a time on the monotonic clock
+void sleepUntil(int64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+// Count one frame time in milliseconds
+void recordFrame(frameTimes_t& t, double ms) {
+  int b = (int)(ms * 1000 / FRAME_BIN_US);
+  if (b >= (int)t.counts.size() - 1) {
+    b = t.counts.size() - 1;
+    record(t.tail, ms);
+  }
+  t.counts[b]++;
+  t.total++;
+  if (ms > t.max) {
+    t.max = ms;
+  }
+}
+
+// Get a frame time that a fraction q of the frames took no longer than, to
+// the top of its bin, or past the bins, of its bucket in the tail
+double framePercentile(frameTimes_t& t, double q) {
+  long seen = 0;
+  int last = t.counts.size() - 1;
+  for (int b = 0; b < last; b++) {
+    seen += t.counts[b];
+    if (seen > 0 && seen >= q * t.total) {
+      return fmin((b + 1) * FRAME_BIN_US / 1000.0, t.max);
+    }
+  }
+  if (t.tail.total == 0) {
+    return t.max;
+  }
+  return fmax(percentile(t.tail, (q * t.total - seen) / t.tail.total), last * FRAME_BIN_US / 1000.0);
+}
+
+// Time the next frame from now, after frames that weren't paced
+void skipPacing() {
+  pacing.lastEnd = paceClock();
+  pacing.deadline = pacing.lastEnd;
+}
+
+// Start the first frame's deadline from now
+void startPacing() {
+  skipPacing();
+  pacing.overruns = pacing.dropped = 0;
+  pacing.frameTimes.counts.assign(FRAME_BIN_PERIODS * 1000000 / cfg.fps / FRAME_BIN_US + 1, 0);
+  pacing.frameTimes.tail = histogram_t();
+  pacing.frameTimes.total = 0;
+  pacing.frameTimes.max = 0;
+}
+
+// Wait for the end of this frame, and count how it went
+void paceFrame() {
+  int64_t period = 1000000000 / cfg.fps;
+  pacing.deadline += period;
+  int64_t now = paceClock();
+  if (now > pacing.deadline) {
+    ++pacing.overruns;
+    int64_t missed = (now - pacing.deadline) / period;
+    pacing.dropped += missed;
+    pacing.deadline += missed * period;
+  }
+  else {
+    int64_t spin = (int64_t)cfg.paceSpin * 1000;
+    if (pacing.deadline - now > spin) {
+      sleepUntil(pacing.deadline - spin);
+    }
+    while (paceClock() < pacing.deadline) {
+    }
+    now = paceClock();
+  }
+
+  recordFrame(pacing.frameTimes, (now - pacing.lastEnd) / 1e6);
+  pacing.lastEnd = now;
+  storeFrames(framePercentile(pacing.frameTimes, 0.5), framePercentile(pacing.frameTimes, 0.99),
+              pacing.frameTimes.max, pacing.overruns, pacing.dropped);
+}
+
+// Say how steady the frames were: the frame times, with the bins from the
+// shortest to the longest frame joined into at most FRAME_PRINT_ROWS rows
+void printPacing() {
+  frameTimes_t& t = pacing.frameTimes;
+  printf("Frame times: %ld frames, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n", t.total,
+         framePercentile(t, 0.5), framePercentile(t, 0.99), framePercentile(t, 0.999), t.max);
+  int first = 0, last = (int)t.counts.size() - 1;
+  while (first < last && t.counts[first] == 0) first++;
+  while (last > first && t.counts[last] == 0) last--;
+  int join = (last - first) / FRAME_PRINT_ROWS + 1;
+  std::vector<long> rows((last - first) / join + 1, 0);
+  long most = 1;
+  for (int b = first; b <= last; b++) {
+    long& n = rows[(b - first) / join];
+    n += t.counts[b];
+    if (n > most) most = n;
+  }
+  long seen = 0;
+  for (int i = 0; i < rows.size() && t.total > 0; i++) {
+    seen += rows[i];
+    char bar[51];
+    int len = (int)(50 * rows[i] / most);
+    for (int k = 0; k < len; k++) bar[k] = '#';
+    bar[len] = '\0';
+    // The last bin has no top; the longest frame in it is
+    int top = first + (i + 1) * join;
+    double topMs = top < t.counts.size() ? top * FRAME_BIN_US / 1000.0 : t.max;
+    printf("  <= %9.3f ms %8ld %5.1f%% %s\n", topMs, rows[i], 100.0 * seen / t.total, bar);
+  }
+  printf("%ld frames overran, %ld dropped to catch up\n", pacing.overruns, pacing.dropped);
+}
+
+#endif
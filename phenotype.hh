@@ -0,0 +1,62 @@
+/* phenotype.hh turns trait values into the numbers the simulation uses.   *
+ * Every trait is 8 bits, so each formula is evaluated for all 256 values  *
+ * at compile time and creatures just look their values up. Formulas with  *
+ * configurable bounds store where the trait falls between them.           */
+
+#if !defined(PHENOTYPE_HH)
+#define PHENOTYPE_HH
+
+// A list of the integers 0..N-1 as template arguments, used to fill tables
+template<int... I> struct indices {};
+template<int N, int... I> struct makeIndices : makeIndices<N - 1, N - 1, I...> {};
+template<int... I> struct makeIndices<0, I...> { typedef indices<I...> type; };
+
+// A table of N precomputed values
+template<int N> struct phenoTable {
+  double v[N];
+  constexpr double operator[](int i) const { return v[i]; }
+};
+
+// Fill a table with F::at(i) for every index
+template<typename F, int... I>
+constexpr phenoTable<sizeof...(I)> buildTable(indices<I...>) {
+  return phenoTable<sizeof...(I)>{{ F::at(I)... }};
+}
+
+template<typename F, int N>
+constexpr phenoTable<N> buildTable() {
+  return buildTable<F>(typename makeIndices<N>::type());
+}
+
+// How far a trait is between its minimum and maximum effect (radius, lifetime)
+struct fractionFormula {
+  static constexpr double at(int trait) { return (double)trait / 255.0; }
+};
+
+// Distance covered per second from the speed trait, before the size penalty
+struct speedFormula {
+  static constexpr double at(int speed) { return (double)speed / 2; }
+};
+
+// Bigger creatures are slower
+struct sizeSpeedFormula {
+  static constexpr double at(int size) { return (1 - ((double)size / 255)) * 1.5 + .5; }
+};
+
+// How much a creature gets out of food (inversely proportional to _energy)
+struct digestFormula {
+  static constexpr double at(int energy) { return (1 - ((double)energy / 255)) * 1.5 + .5; }
+};
+
+// Metabolism from the sum of the vision, size and speed traits
+struct metabolismFormula {
+  static constexpr double at(int sum) { return ((double)sum / (255*3)) * 1.5 + .5; }
+};
+
+constexpr phenoTable<256> FRACTION_TABLE = buildTable<fractionFormula, 256>();
+constexpr phenoTable<256> SPEED_TABLE = buildTable<speedFormula, 256>();
+constexpr phenoTable<256> SIZE_SPEED_TABLE = buildTable<sizeSpeedFormula, 256>();
+constexpr phenoTable<256> DIGEST_TABLE = buildTable<digestFormula, 256>();
+constexpr phenoTable<255*3+1> METABOLISM_TABLE = buildTable<metabolismFormula, 255*3+1>();
+
+#endif
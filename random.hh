@@ -0,0 +1,25 @@
+/* random.hh is the random number generator of the simulation. Unlike      *
+ * rand(), its whole state is one number, so it can be handed to another   *
+ * process and a run can be repeated exactly from its seed.                */
+
+#if !defined(RANDOM_HH)
+#define RANDOM_HH
+
+#include <stdint.h>
+
+// The generator's state
+uint64_t rngState = 1;
+
+// Start the sequence over from a seed
+void seedRandom(uint64_t seed) { rngState = seed; }
+
+// Get a random number from 0 to 2^31-1, like rand() (splitmix64)
+int simRand() {
+  uint64_t z = (rngState += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return (int)(z >> 33);
+}
+
+#endif
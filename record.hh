@@ -0,0 +1,274 @@
+/* record.hh records a run (--record=FILE) so it can be replayed exactly    *
+ * (--replay=FILE). A record is a config file of the settings that shape   *
+ * the simulation, the seed and region layout included, then its events:   *
+ * the plan period, the one thing the clock decides, whenever it changes,  *
+ * and a hash of the whole world every --hash-every ticks. A replay runs    *
+ * headless, as fast as it can, up to --replay-until and checks the hashes *
+ * on the way, stopping at the first that differs from the record.         *
+ * Then it carries on in the window, or with --replay-dump=FILE, writes the *
+ * creatures out and stops.                                                 */
+
+#if !defined(RECORD_HH)
+#define RECORD_HH
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "field.hh"
+#include "lineage.hh"
+#include "random.hh"
+#include "shard.hh"
+#include "threads.hh"
+#include "world.hh"
+
+typedef struct tape {
+  FILE* out;        // The record being written, or NULL
+  int writtenPlan;  // The plan period last written to it
+
+  bool on;                          // Are we replaying
+  std::map<int, int> plans;         // Plan period from each tick it changed on
+  std::map<int, uint64_t> hashes;   // Hash of the world after some ticks
+  int end;                          // Last tick of the record
+  int until;                        // Tick to run headless up to
+  long checked;                     // Hashes that matched so far
+  bool diverged;                    // Did a hash not match
+
+  std::vector<uint64_t> regionHashes; // Hash of each of our regions, while hashing
+} tape_t;
+
+tape_t tape;
+
+// Settings that don't change what happens, but where this run's output goes
+// or how it is replayed, so a replay doesn't write over the recorded run's
+const char* unrecorded[] = {
+  "capture", "capture-every", "capture-scale", "capture-buffers", "lineage", "data",
+  "record", "replay", "replay-until", "replay-dump", "metrics",
+  "stream", "stream-every", "stream-quantum", "stream-buffers",
+  "traits", "traits-every", "pace-spin"
+};
+
+// Start writing a record of this run, if one was asked for, with the settings
+// given, then the seed and region layout used, whether given or picked
+void startRecord() {
+  tape.out = NULL;
+  if (cfg.record.empty()) {
+    return;
+  }
+  tape.out = fopen(cfg.record.c_str(), "w");
+  if (tape.out == NULL) {
+    fprintf(stderr, "Failed to open %s for the record\n", cfg.record.c_str());
+    exit(1);
+  }
+  fprintf(tape.out, "# Replay with ./evo --replay=%s\n", cfg.record.c_str());
+  for (size_t i = 0; i < givenSettings.size(); i++) {
+    const std::string& s = givenSettings[i];
+    std::string name = s.substr(0, s.find(" = "));
+    bool recorded = name != "seed" && name != "regions-x" && name != "regions-y";
+    for (size_t k = 0; k < sizeof(unrecorded) / sizeof(unrecorded[0]); k++) {
+      recorded = recorded && name != unrecorded[k];
+    }
+    if (recorded) {
+      fprintf(tape.out, "%s\n", s.c_str());
+    }
+  }
+  fprintf(tape.out, "seed = %u\nregions-x = %d\nregions-y = %d\n[events]\n", cfg.seed, regionCols, regionRows);
+  tape.writtenPlan = 0;
+}
+
+// Read the events of the record being replayed, if there is one
+void loadReplay() {
+  tape.on = !cfg.replay.empty();
+  if (!tape.on) {
+    return;
+  }
+  FILE* f = fopen(cfg.replay.c_str(), "r");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to open %s to replay\n", cfg.replay.c_str());
+    exit(1);
+  }
+  char line[512];
+  bool events = false;
+  tape.end = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    int tick, plan;
+    unsigned long long hash;
+    if (!events) {
+      events = !strcmp(line, "[events]");
+    }
+    else if (sscanf(line, "plan %d %d", &tick, &plan) == 2) {
+      tape.plans[tick] = plan;
+      tape.end = std::max(tape.end, tick);
+    }
+    else if (sscanf(line, "hash %d %llx", &tick, &hash) == 2) {
+      tape.hashes[tick] = hash;
+      tape.end = std::max(tape.end, tick);
+    }
+    else if (line[0] != '\0') {
+      fprintf(stderr, "%s: bad event '%s'\n", cfg.replay.c_str(), line);
+      exit(1);
+    }
+  }
+  fclose(f);
+  tape.until = cfg.replayUntil >= 0 ? cfg.replayUntil : tape.end;
+  tape.checked = 0;
+  tape.diverged = false;
+}
+
+// Is the replay still running headless before some tick
+bool headlessAt(int tick) {
+  return tape.on && tick < tape.until;
+}
+
+// Is the replay over: it went wrong, or reached the tick to dump at
+bool tapeDone(int tick) {
+  return tape.on && (tape.diverged || (!cfg.replayDump.empty() && tick >= tape.until));
+}
+
+// Before a tick, plan as often as the recorded run did on it, or note how
+// often we plan, if it changed
+void tapeTick(int tick, int* planPeriod) {
+  if (tape.on && tick <= tape.end) {
+    std::map<int, int>::iterator it = tape.plans.upper_bound(tick);
+    if (it != tape.plans.begin()) {
+      *planPeriod = (--it)->second;
+    }
+  }
+  if (tape.out != NULL && *planPeriod != tape.writtenPlan) {
+    fprintf(tape.out, "plan %d %d\n", tick, *planPeriod);
+    tape.writtenPlan = *planPeriod;
+  }
+}
+
+// Mix a number into a hash (splitmix64)
+uint64_t mixHash(uint64_t h, uint64_t v) {
+  uint64_t z = h ^ (v + 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Mix the bits of a double into a hash
+uint64_t mixDouble(uint64_t h, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  return mixHash(h, v);
+}
+
+// Hash the creatures and plants of a region. Each is hashed alone and the
+// hashes added up, so the order they are kept in doesn't matter
+void hashRegion(int r) {
+  region_t& reg = regions[r];
+  uint64_t sum = 0;
+  for (int i = 0; i < reg.creatures.size(); i++) {
+    creature* c = reg.creatures[i];
+    uint64_t h = mixHash(c->id(), c->genome());
+    h = mixHash(h, (uint64_t)c->food_source());
+    h = mixDouble(h, c->pos().x());
+    h = mixDouble(h, c->pos().y());
+    h = mixDouble(h, c->vel().x());
+    h = mixDouble(h, c->vel().y());
+    h = mixDouble(h, c->curr_energy());
+    sum += h;
+  }
+  for (int i = 0; i < reg.plants.size(); i++) {
+    sum += mixDouble(mixDouble(0, reg.plants[i]->pos().x()), reg.plants[i]->pos().y());
+  }
+  tape.regionHashes[r] = sum;
+}
+
+// Hash the whole world, which comes out the same however many processes
+// share it. Only the first process gets the whole hash
+uint64_t worldHash() {
+  tape.regionHashes.resize(regions.size());
+  runTasks(&hashRegion, firstRegion, lastRegion);
+  uint64_t sum = 0;
+  for (int r = firstRegion; r < lastRegion; r++) {
+    sum += tape.regionHashes[r];
+  }
+  if (grass.on) {
+    for (size_t i = (size_t)grass.firstRow * grass.cols; i < (size_t)grass.lastRow * grass.cols; i++) {
+      sum += mixHash((uint64_t)i, (uint64_t)grass.mass[i]);
+    }
+  }
+
+  message m;
+  if (shardRank != 0) {
+    m.put(sum);
+    send(0, m);
+    return 0;
+  }
+  for (int p = 1; p < shardCount; p++) {
+    receive(p, m);
+    sum += m.get<uint64_t>();
+  }
+  return mixHash(mixHash(sum, rngState), lastId);
+}
+
+// After some ticks, write the hash of the world to the record, or check it
+// against the one recorded
+void checkTick(int tick) {
+  bool replaying = tape.on && tape.hashes.count(tick) > 0;
+  if (cfg.hashEvery == 0 || tick % cfg.hashEvery != 0 || (cfg.record.empty() && !replaying)) {
+    return;
+  }
+  uint64_t hash = worldHash();
+  if (shardRank != 0) {
+    return;
+  }
+  if (tape.out != NULL) {
+    fprintf(tape.out, "hash %d %016llx\n", tick, (unsigned long long)hash);
+  }
+  if (replaying) {
+    if (hash == tape.hashes[tick]) {
+      ++tape.checked;
+    }
+    else if (!tape.diverged) {
+      fprintf(stderr, "The replay went differently from the record at tick %d: hash %016llx, recorded %016llx\n",
+              tick, (unsigned long long)hash, (unsigned long long)tape.hashes[tick]);
+      tape.diverged = true;
+    }
+  }
+}
+
+// Write this process's creatures to FILE, or FILE.1, FILE.2... for the others
+void dumpCreatures(int tick) {
+  std::string path = cfg.replayDump;
+  if (shardRank > 0) {
+    path += "." + std::to_string(shardRank);
+  }
+  FILE* f = fopen(path.c_str(), "w");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to open %s for the dump\n", path.c_str());
+    return;
+  }
+  fprintf(f, "Tick,Id,Diet,Color,Size,Speed,Energy,Vision,X,Y,VX,VY,Stored\n");
+  for (int r = firstRegion; r < lastRegion; r++) {
+    for (int i = 0; i < regions[r].creatures.size(); i++) {
+      creature* c = regions[r].creatures[i];
+      fprintf(f, "%d,%llu,%d,%d,%d,%d,%d,%d,%.17g,%.17g,%.17g,%.17g,%.17g\n", tick,
+              (unsigned long long)c->id(), c->food_source(), c->getTrait(TRAIT_COLOR), c->getTrait(TRAIT_SIZE),
+              c->getTrait(TRAIT_SPEED), c->getTrait(TRAIT_ENERGY), c->getTrait(TRAIT_VISION),
+              c->pos().x(), c->pos().y(), c->vel().x(), c->vel().y(), c->curr_energy());
+    }
+  }
+  fclose(f);
+}
+
+// Finish the record, and say how the replay went
+void stopRecord() {
+  if (tape.out != NULL) {
+    fclose(tape.out);
+  }
+  if (tape.on && shardRank == 0 && !tape.diverged) {
+    printf("Replay matched the record at all %ld hashes checked\n", tape.checked);
+  }
+}
+
+#endif
@@ -0,0 +1,621 @@
+/* shard.hh runs one world as several processes on the same host, so a big  *
+ * world can use the memory bandwidth of more than one NUMA node. Each      *
+ * process owns a stripe of region rows (see world.hh) and simulates it     *
+ * with its own threads. Processes talk through ring buffers in memory they *
+ * all share, one ring for each sender and receiver, and meet at a shared   *
+ * barrier every frame. Every tick they swap copies of the creatures and    *
+ * plants along their stripe's edges and the creatures moving across them.  */
+
+#if !defined(SHARD_HH)
+#define SHARD_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.hh"
+#include "creature.hh"
+#include "field.hh"
+#include "lineage.hh"
+#include "random.hh"
+#include "view.hh"
+#include "world.hh"
+
+#define RING_SIZE (1 << 20) // Bytes in flight from one process to another
+
+// Bytes sent from one process to another. Both counters only ever grow.
+// Anonymous shared memory starts zeroed, which is an empty ring
+typedef struct ring {
+  std::atomic<uint64_t> head; // Bytes written so far
+  std::atomic<uint64_t> tail; // Bytes read so far
+  char data[RING_SIZE];
+} ring_t;
+
+// What the first process, which has the window, tells the others every frame
+typedef struct frameControl {
+  pthread_barrier_t barrier;
+  bool running; // Keep going, or everyone exits
+  int ticks;    // Simulation ticks to run this frame
+  int planPeriod; // Ticks between a creature's plans
+  view_t view;    // What the window shows
+  bool headless;  // Run the ticks without showing them (see record.hh)
+  bool drawn;     // Draw this frame: when shown, or headless but captured
+} frameControl_t;
+
+// This process, and how many processes share the world
+int shardRank = 0;
+int shardCount = 1;
+
+// Memory every process shares
+frameControl_t* control;
+ring_t* rings;
+void* sharedPixels;
+
+// The other processes, started by the first one
+std::vector<pid_t> shardPids;
+
+// Our regions each other process needs copies of, and theirs we need
+std::vector<std::vector<int> > sendRegions;
+std::vector<std::vector<int> > recvRegions;
+
+// Babies made in the border pass so far this tick, and how many of them
+// had been made when we handed the pass on
+std::vector<creatureState_t> births;
+size_t birthsPassed;
+
+// A message between processes: its length, then values copied byte for byte
+class message {
+public:
+  message() { clear(); }
+
+  // Empty the message to write or receive a new one
+  void clear() {
+    _data.assign(sizeof(uint64_t), 0);
+    _read = sizeof(uint64_t);
+    _moved = 0;
+  }
+
+  // Append a value
+  template<typename T> void put(const T& v) {
+    const char* p = (const char*)&v;
+    _data.insert(_data.end(), p, p + sizeof(T));
+  }
+
+  // Take the next value
+  template<typename T> T get() {
+    T v;
+    memcpy(&v, &_data[_read], sizeof(T));
+    _read += sizeof(T);
+    return v;
+  }
+
+  // Has every value been taken
+  bool done() { return _read >= _data.size(); }
+
+  // Write as much of the message as fits in a ring. Returns true once it is all sent
+  bool sendSome(ring_t* r) {
+    if (_moved == 0) {
+      uint64_t length = _data.size();
+      memcpy(&_data[0], &length, sizeof(length));
+    }
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    uint64_t tail = r->tail.load(std::memory_order_acquire);
+    size_t n = std::min<size_t>(RING_SIZE - (head - tail), _data.size() - _moved);
+    for (size_t i = 0; i < n; ) {
+      size_t at = (head + i) % RING_SIZE;
+      size_t piece = std::min<size_t>(n - i, RING_SIZE - at);
+      memcpy(&r->data[at], &_data[_moved + i], piece);
+      i += piece;
+    }
+    r->head.store(head + n, std::memory_order_release);
+    _moved += n;
+
+    if (_moved < _data.size()) {
+      return false;
+    }
+    _moved = 0;
+    return true;
+  }
+
+  // Read as much of a message as has arrived in a ring. Returns true once it is all here
+  bool receiveSome(ring_t* r) {
+    uint64_t head = r->head.load(std::memory_order_acquire);
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    while (tail < head) {
+      // The length comes first, then we know how much follows
+      size_t want = (_moved < sizeof(uint64_t) ? sizeof(uint64_t) : _data.size()) - _moved;
+      size_t n = std::min<size_t>(want, head - tail);
+      for (size_t i = 0; i < n; ) {
+        size_t at = (tail + i) % RING_SIZE;
+        size_t piece = std::min<size_t>(n - i, RING_SIZE - at);
+        memcpy(&_data[_moved + i], &r->data[at], piece);
+        i += piece;
+      }
+      tail += n;
+      _moved += n;
+      if (_moved == sizeof(uint64_t)) {
+        uint64_t length;
+        memcpy(&length, &_data[0], sizeof(length));
+        _data.resize(length);
+      }
+      if (_moved == _data.size()) {
+        break;
+      }
+    }
+    r->tail.store(tail, std::memory_order_release);
+
+    if (_moved < sizeof(uint64_t) || _moved < _data.size()) {
+      return false;
+    }
+    _moved = 0;
+    _read = sizeof(uint64_t);
+    return true;
+  }
+
+private:
+  std::vector<char> _data;
+  size_t _read;  // Where the next value is taken from
+  size_t _moved; // Bytes sent or received so far
+};
+
+// The ring from one process to another
+ring_t* ringBetween(int from, int to) {
+  return &rings[from * shardCount + to];
+}
+
+// Send a message to another process, waiting while its ring is full
+void send(int to, message& m) {
+  while (!m.sendSome(ringBetween(shardRank, to))) {
+    sched_yield();
+  }
+}
+
+// Wait for a message from another process
+void receive(int from, message& m) {
+  m.clear();
+  while (!m.receiveSome(ringBetween(from, shardRank))) {
+    sched_yield();
+  }
+}
+
+// Send out[p] to and receive in[p] from every other process at once, so two
+// processes never wait on each other's full rings
+void exchange(std::vector<message>& out, std::vector<message>& in) {
+  std::vector<bool> sent(shardCount, false);
+  std::vector<bool> got(shardCount, false);
+  in.resize(shardCount);
+  for (int p = 0; p < shardCount; p++) {
+    in[p].clear();
+  }
+
+  int left = 2 * (shardCount - 1);
+  while (left > 0) {
+    for (int p = 0; p < shardCount; p++) {
+      if (p == shardRank) {
+        continue;
+      }
+      if (!sent[p] && out[p].sendSome(ringBetween(shardRank, p))) {
+        sent[p] = true;
+        --left;
+      }
+      if (!got[p] && in[p].receiveSome(ringBetween(p, shardRank))) {
+        got[p] = true;
+        --left;
+      }
+    }
+    if (left > 0) {
+      sched_yield();
+    }
+  }
+}
+
+// Wait until every process gets here
+void shardBarrier() {
+  if (shardCount > 1) {
+    pthread_barrier_wait(&control->barrier);
+  }
+}
+
+// Share memory for the frame control, the rings and the pixels, then fork
+// the other processes. Every process returns from here with its own rank
+void startShards(int processes, size_t pixelBytes) {
+  shardCount = processes;
+  size_t ringBytes = sizeof(ring_t) * processes * processes;
+  size_t bytes = sizeof(frameControl_t) + ringBytes + pixelBytes;
+  char* mem = (char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("Failed to map shared memory");
+    exit(1);
+  }
+  control = (frameControl_t*)mem;
+  rings = (ring_t*)(mem + sizeof(frameControl_t));
+  sharedPixels = mem + sizeof(frameControl_t) + ringBytes;
+
+  pthread_barrierattr_t attr;
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&control->barrier, &attr, processes);
+  pthread_barrierattr_destroy(&attr);
+
+  pid_t parent = getpid();
+  for (int p = 1; p < processes; p++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("Failed to start a process");
+      exit(1);
+    }
+    if (pid == 0) {
+      // Don't outlive the first process, even if it dies without telling us
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      if (getppid() != parent) {
+        exit(1);
+      }
+      shardRank = p;
+      shardPids.clear();
+      return;
+    }
+    shardPids.push_back(pid);
+  }
+}
+
+// Wait for the other processes to exit
+void stopShards() {
+  for (int i = 0; i < shardPids.size(); i++) {
+    waitpid(shardPids[i], NULL, 0);
+  }
+}
+
+// Work out which regions we swap with each other process: a region's
+// border goes to every process owning a region it is in reach of
+void initPeers() {
+  sendRegions.assign(shardCount, std::vector<int>());
+  recvRegions.assign(shardCount, std::vector<int>());
+  for (int q = 0; q < regions.size(); q++) {
+    std::vector<bool> needed(shardCount, false);
+    for (int r = 0; r < regions.size(); r++) {
+      if (regionOwner[r] != regionOwner[q] && inReach(regions[r], regions[q])) {
+        needed[regionOwner[r]] = true;
+      }
+    }
+    for (int p = 0; p < shardCount; p++) {
+      if (!needed[p]) {
+        continue;
+      }
+      if (regionOwner[q] == shardRank) {
+        sendRegions[p].push_back(q);
+      }
+      else if (p == shardRank) {
+        recvRegions[regionOwner[q]].push_back(q);
+      }
+    }
+  }
+}
+
+// Replace a region's copied border with the one in a message. A copy of a
+// creature with the same genome only has to catch up with its state
+void readBorder(region_t& reg, message& m) {
+  int n = m.get<int>();
+  for (int i = n; i < reg.border.size(); i++) {
+    delete reg.border[i];
+  }
+  if (n < reg.border.size()) {
+    reg.border.resize(n);
+  }
+  for (int i = 0; i < n; i++) {
+    creatureState_t s = m.get<creatureState_t>();
+    if (i == reg.border.size()) {
+      reg.border.push_back(new creature(s));
+    }
+    else if (reg.border[i]->genome() != s.genome || reg.border[i]->food_source() != s.food_source) {
+      delete reg.border[i];
+      reg.border[i] = new creature(s);
+    }
+    else {
+      reg.border[i]->setState(s);
+    }
+  }
+
+  for (int i = 0; i < reg.borderPlants.size(); i++) {
+    delete reg.borderPlants[i];
+  }
+  reg.borderPlants.resize(m.get<int>());
+  for (int i = 0; i < reg.borderPlants.size(); i++) {
+    reg.borderPlants[i] = new plant(m.get<vec2d>(), false);
+  }
+}
+
+// Swap the creatures and plants along our edges, once borders are found
+void sendBorders() {
+  std::vector<message> out(shardCount), in;
+  for (int p = 0; p < shardCount; p++) {
+    for (int k = 0; k < sendRegions[p].size(); k++) {
+      region_t& reg = regions[sendRegions[p][k]];
+      out[p].put((int)reg.border.size());
+      for (int i = 0; i < reg.border.size(); i++) {
+        out[p].put(reg.border[i]->state());
+      }
+      out[p].put((int)reg.borderPlants.size());
+      for (int i = 0; i < reg.borderPlants.size(); i++) {
+        out[p].put(reg.borderPlants[i]->pos());
+      }
+    }
+  }
+  exchange(out, in);
+
+  for (int p = 0; p < shardCount; p++) {
+    for (int k = 0; k < recvRegions[p].size(); k++) {
+      readBorder(regions[recvRegions[p][k]], in[p]);
+    }
+  }
+}
+
+// Swap who along our edges is being chased, once everyone has looked around
+void sendStatuses() {
+  std::vector<message> out(shardCount), in;
+  for (int p = 0; p < shardCount; p++) {
+    for (int k = 0; k < sendRegions[p].size(); k++) {
+      region_t& reg = regions[sendRegions[p][k]];
+      for (int i = 0; i < reg.border.size(); i++) {
+        out[p].put((int8_t)reg.border[i]->status());
+      }
+    }
+  }
+  exchange(out, in);
+
+  for (int p = 0; p < shardCount; p++) {
+    for (int k = 0; k < recvRegions[p].size(); k++) {
+      region_t& reg = regions[recvRegions[p][k]];
+      for (int i = 0; i < reg.border.size(); i++) {
+        reg.border[i]->setStatus(in[p].get<int8_t>());
+      }
+    }
+  }
+}
+
+// Swap where everyone along our edges ended up and which plants were eaten,
+// once the collisions inside each region are done
+void sendStates() {
+  std::vector<message> out(shardCount), in;
+  for (int p = 0; p < shardCount; p++) {
+    for (int k = 0; k < sendRegions[p].size(); k++) {
+      region_t& reg = regions[sendRegions[p][k]];
+      for (int i = 0; i < reg.border.size(); i++) {
+        out[p].put(reg.border[i]->state());
+      }
+      for (int i = 0; i < reg.borderPlants.size(); i++) {
+        out[p].put(reg.borderPlants[i]->eaten());
+      }
+    }
+  }
+  exchange(out, in);
+
+  for (int p = 0; p < shardCount; p++) {
+    for (int k = 0; k < recvRegions[p].size(); k++) {
+      region_t& reg = regions[recvRegions[p][k]];
+      for (int i = 0; i < reg.border.size(); i++) {
+        reg.border[i]->setState(in[p].get<creatureState_t>());
+      }
+      for (int i = 0; i < reg.borderPlants.size(); i++) {
+        if (in[p].get<bool>()) {
+          reg.borderPlants[i]->setEaten();
+        }
+      }
+    }
+  }
+}
+
+// Key of a creature or plant by its region and its place in that region's border
+uint64_t borderKey(int r, int i) {
+  return (uint64_t)r << 32 | (uint32_t)i;
+}
+
+// Latest states of border creatures changed by the border pass so far
+std::map<uint64_t, creatureState_t> passedCreatures;
+
+// Border plants eaten so far
+std::set<uint64_t> passedPlants;
+
+// Take over the border pass from the process before us. Creatures of ours
+// it touched catch up, and babies born in our stripe join it in order
+void receivePass() {
+  message m;
+  receive(shardRank - 1, m);
+  rngState = m.get<uint64_t>();
+  lastId = m.get<uint64_t>();
+
+  passedCreatures.clear();
+  size_t n = m.get<uint64_t>();
+  for (size_t k = 0; k < n; k++) {
+    uint64_t key = m.get<uint64_t>();
+    creatureState_t s = m.get<creatureState_t>();
+    int r = key >> 32;
+    int i = (uint32_t)key;
+    if (r >= firstRegion && i < regions[r].border.size()) {
+      regions[r].border[i]->setState(s);
+    }
+    if (r >= lastRegion) {
+      passedCreatures[key] = s;
+    }
+  }
+
+  passedPlants.clear();
+  n = m.get<uint64_t>();
+  for (size_t k = 0; k < n; k++) {
+    uint64_t key = m.get<uint64_t>();
+    int r = key >> 32;
+    int i = (uint32_t)key;
+    if (i < regions[r].borderPlants.size()) {
+      regions[r].borderPlants[i]->setEaten();
+    }
+    passedPlants.insert(key);
+  }
+
+  n = m.get<uint64_t>();
+  for (size_t k = 0; k < n; k++) {
+    births.push_back(m.get<creatureState_t>());
+    addCreature(new creature(births.back()));
+  }
+}
+
+// Put what the border pass has done so far in a message
+void writePass(message& m) {
+  m.put(rngState);
+  m.put(lastId);
+  m.put((uint64_t)passedCreatures.size());
+  for (std::map<uint64_t, creatureState_t>::iterator it = passedCreatures.begin();
+       it != passedCreatures.end(); ++it) {
+    m.put(it->first);
+    m.put(it->second);
+  }
+  m.put((uint64_t)passedPlants.size());
+  for (std::set<uint64_t>::iterator it = passedPlants.begin(); it != passedPlants.end(); ++it) {
+    m.put(*it);
+  }
+  m.put((uint64_t)births.size());
+  for (size_t k = 0; k < births.size(); k++) {
+    m.put(births[k]);
+  }
+}
+
+// Hand the border pass on once our regions are done. The last process tells
+// everyone how it ended: the plants eaten, the babies made after them, and
+// where the random numbers and creature numbers got to
+void passOn() {
+  message m;
+  if (shardRank < shardCount - 1) {
+    // The next processes need the copies we changed of their creatures
+    for (int r = lastRegion; r < regions.size(); r++) {
+      for (int i = 0; i < regions[r].border.size(); i++) {
+        passedCreatures[borderKey(r, i)] = regions[r].border[i]->state();
+      }
+    }
+  }
+  else {
+    passedCreatures.clear();
+  }
+  for (int r = 0; r < regions.size(); r++) {
+    for (int i = 0; i < regions[r].borderPlants.size(); i++) {
+      if (regions[r].borderPlants[i]->eaten()) {
+        passedPlants.insert(borderKey(r, i));
+      }
+    }
+  }
+  writePass(m);
+  birthsPassed = births.size();
+
+  if (shardRank < shardCount - 1) {
+    send(shardRank + 1, m);
+
+    // Wait for the end of the pass
+    receive(shardCount - 1, m);
+    rngState = m.get<uint64_t>();
+    lastId = m.get<uint64_t>();
+    m.get<uint64_t>(); // No creatures
+    size_t n = m.get<uint64_t>();
+    for (size_t k = 0; k < n; k++) {
+      uint64_t key = m.get<uint64_t>();
+      int r = key >> 32;
+      int i = (uint32_t)key;
+      if (ownsRegion(r)) {
+        regions[r].borderPlants[i]->setEaten();
+      }
+    }
+    n = m.get<uint64_t>();
+    for (size_t k = 0; k < n; k++) {
+      creatureState_t s = m.get<creatureState_t>();
+      if (k >= birthsPassed) {
+        addCreature(new creature(s));
+      }
+    }
+  }
+  else {
+    for (int p = 0; p < shardCount - 1; p++) {
+      send(p, m);
+    }
+  }
+
+  births.clear();
+  passedPlants.clear();
+  passedCreatures.clear();
+}
+
+// Hand creatures that moved into other processes' regions to them, after
+// they were sent to the outboxes of those regions
+void sendMigrants() {
+  std::vector<message> out(shardCount), in;
+  for (int q = firstRegion; q < lastRegion; q++) {
+    for (int r = 0; r < regions.size(); r++) {
+      std::vector<creature*>& leaving = regions[q].outbox[r];
+      if (ownsRegion(r) || leaving.empty()) {
+        continue;
+      }
+      message& m = out[regionOwner[r]];
+      m.put(q);
+      m.put(r);
+      m.put((int)leaving.size());
+      for (int i = 0; i < leaving.size(); i++) {
+        m.put(leaving[i]->state());
+        delete leaving[i];
+      }
+      leaving.clear();
+    }
+  }
+  exchange(out, in);
+
+  for (int p = 0; p < shardCount; p++) {
+    while (!in[p].done()) {
+      int q = in[p].get<int>();
+      int r = in[p].get<int>();
+      int n = in[p].get<int>();
+      for (int i = 0; i < n; i++) {
+        regions[q].outbox[r].push_back(new creature(in[p].get<creatureState_t>()));
+      }
+    }
+  }
+}
+
+// Swap the rows of the food field around our stripe's edges, once they have
+// grown, so everyone can spread them and look at them
+void sendField() {
+  std::vector<message> out(shardCount), in;
+  for (int p = 0; p < shardCount; p++) {
+    if (p == shardRank) {
+      continue;
+    }
+    int first = std::max(grass.firstRow, stripeRow(p, shardCount) - grass.halo);
+    int last = std::min(grass.lastRow, stripeRow(p + 1, shardCount) + grass.halo);
+    out[p].put(first);
+    out[p].put(last);
+    for (size_t i = (size_t)first * grass.cols; i < (size_t)std::max(first, last) * grass.cols; i++) {
+      out[p].put(grass.mass[i]);
+    }
+  }
+  exchange(out, in);
+
+  for (int p = 0; p < shardCount; p++) {
+    if (p == shardRank) {
+      continue;
+    }
+    int first = in[p].get<int>();
+    int last = in[p].get<int>();
+    for (size_t i = (size_t)first * grass.cols; i < (size_t)std::max(first, last) * grass.cols; i++) {
+      grass.mass[i] = in[p].get<int32_t>();
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,115 @@
+/* storage.hh lets the creatures and plants of a region be moved next to    *
+ * each other in memory, in Z-order (Morton order) of their positions, so   *
+ * that neighbours in the world are mostly neighbours in memory too. Every  *
+ * object is allocated with a small header naming the block it lives in:    *
+ * none for an object allocated on its own, or a packed block that is       *
+ * freed once the last object in it is deleted.                             */
+
+#if !defined(STORAGE_HH)
+#define STORAGE_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdint.h>
+#include <vector>
+
+#define STORAGE_HEADER 16 // Bytes before every object, keeping it aligned
+
+// A packed block, followed by its objects
+typedef struct block {
+  std::atomic<long> live; // Objects in the block not deleted yet
+} block_t;
+
+// Get the header of an object
+block_t** headerOf(void* obj) {
+  return (block_t**)((char*)obj - STORAGE_HEADER);
+}
+
+// Allocate one object on its own
+void* allocateObject(size_t size) {
+  char* p = (char*)malloc(STORAGE_HEADER + size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  *(block_t**)p = NULL;
+  return p + STORAGE_HEADER;
+}
+
+// Free an object, and its block once the block is empty
+void releaseObject(void* obj) {
+  if (obj == NULL) {
+    return;
+  }
+  block_t* b = *headerOf(obj);
+  if (b == NULL) {
+    free(headerOf(obj));
+  }
+  else if (--b->live == 0) {
+    free(b);
+  }
+}
+
+// Move objects into one new block, in the order they are in. Every pointer to
+// the old objects, other than those in items, stops being valid
+template<typename T>
+void pack(std::vector<T*>& items) {
+  if (items.empty()) {
+    return;
+  }
+  size_t stride = (STORAGE_HEADER + sizeof(T) + 15) / 16 * 16;
+  char* mem = (char*)malloc(STORAGE_HEADER + items.size() * stride);
+  if (mem == NULL) {
+    return; // Keep things where they are
+  }
+  block_t* b = new (mem) block_t;
+  b->live = items.size();
+
+  for (size_t i = 0; i < items.size(); i++) {
+    char* p = mem + STORAGE_HEADER + i * stride;
+    *(block_t**)p = b;
+    T* moved = ::new (p + STORAGE_HEADER) T(*items[i]);
+    delete items[i];
+    items[i] = moved;
+  }
+}
+
+// Spread the low 32 bits of a number out to the even bits
+uint64_t spreadBits(uint64_t v) {
+  v &= 0xFFFFFFFFULL;
+  v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+  v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+  v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  v = (v | (v << 2)) & 0x3333333333333333ULL;
+  v = (v | (v << 1)) & 0x5555555555555555ULL;
+  return v;
+}
+
+// Get the Z-order key of a position, counted in whole units from (x0, y0)
+uint64_t mortonKey(double x, double y, double x0, double y0) {
+  double dx = x - x0;
+  double dy = y - y0;
+  uint64_t ix = !(dx >= 0) ? 0 : (dx >= 4294967295.0 ? 0xFFFFFFFFULL : (uint64_t)dx);
+  uint64_t iy = !(dy >= 0) ? 0 : (dy >= 4294967295.0 ? 0xFFFFFFFFULL : (uint64_t)dy);
+  return spreadBits(ix) | spreadBits(iy) << 1;
+}
+
+// Get the order that sorts items by the Z-order key of their positions.
+// Items with the same key keep their order
+template<typename T>
+std::vector<int> mortonOrder(std::vector<T*>& items, double x0, double y0) {
+  std::vector<std::pair<uint64_t, int> > keys(items.size());
+  for (int i = 0; i < items.size(); i++) {
+    keys[i] = std::make_pair(mortonKey(items[i]->pos().x(), items[i]->pos().y(), x0, y0), i);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<int> order(items.size());
+  for (int i = 0; i < items.size(); i++) {
+    order[i] = keys[i].second;
+  }
+  return order;
+}
+
+#endif
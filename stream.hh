@@ -0,0 +1,345 @@
+/* stream.hh publishes the creatures of every tick (--stream=PORT or PATH,  *
+ * see listen.hh) to viewers in other processes, so a headless run can be  *
+ * watched without drawing anything here. The processes gather their        *
+ * creatures at the first one, which hands them to a sender thread (see    *
+ * handOff in threads.hh); when it is behind, the tick is skipped.         *
+ *                                                                          *
+ * A subscriber first gets "EVOSTRM1", then the world width, height and     *
+ * the quantum positions are rounded to, in 65536ths of a unit. Then come  *
+ * frames: the frame length, 'K' or 'D', the tick, and the body. Numbers    *
+ * are LEB128 varints, signed ones zigzagged first. Creatures are sorted by *
+ * id, and each id is sent as the gap from the one before it in its list.   *
+ *   K (whole frame): count, then id gap, x, y, radius, and diet + 2*status *
+ *     for each creature, positions and radius in quanta                    *
+ *   D (changes since the frame before): count and id gaps of creatures    *
+ *     that left; count and creatures that came, as in K; count and the    *
+ *     creatures that moved or changed status: id gap, x and y change      *
+ *     (signed), and diet + 2*status                                        *
+ * A subscriber too slow to take a frame misses it and gets a K frame next. */
+
+#if !defined(STREAM_HH)
+#define STREAM_HH
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "listen.hh"
+#include "shard.hh"
+#include "threads.hh"
+#include "world.hh"
+
+#define STREAM_MAGIC "EVOSTRM1"
+
+// A creature as the processes send it to the first
+typedef struct streamEntity {
+  uint64_t id;
+  float x, y;
+  float radius;
+  uint8_t diet;
+  uint8_t status;
+} streamEntity_t;
+
+// A creature as it is sent to subscribers
+typedef struct streamQuanta {
+  uint64_t id;
+  uint32_t x, y;
+  uint32_t radius;
+  uint8_t flags; // diet + 2 * status
+} streamQuanta_t;
+
+// Someone watching
+typedef struct subscriber {
+  int fd;
+  std::string pending; // Bytes not yet taken by the socket
+  bool synced;         // Did it get the last frame, so it can take changes
+} subscriber_t;
+
+typedef std::vector<streamEntity_t> streamFrame_t;
+
+typedef struct stream {
+  bool on;
+  int listener;
+  std::string path;
+
+  // The creatures gathered this tick, and the sender of frames
+  streamFrame_t gathered;
+  handOff<streamFrame_t> sender;
+
+  // Only the sender touches these
+  std::vector<subscriber_t> subscribers;
+  std::vector<streamQuanta_t> last; // The last frame sent, sorted by id
+
+  long sent;    // Frames encoded and sent
+  long skipped; // Ticks skipped because the sender was behind
+  long missed;  // Frames subscribers were too slow for
+} stream_t;
+
+stream_t streamer;
+
+// Add an unsigned number to a frame
+void putVarint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out += (char)(v | 0x80);
+    v >>= 7;
+  }
+  out += (char)v;
+}
+
+// Add a signed number to a frame
+void putSigned(std::string& out, int64_t v) {
+  putVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+// Round a creature to quanta
+streamQuanta_t quantize(const streamEntity_t& e) {
+  streamQuanta_t q;
+  q.id = e.id;
+  q.x = (uint32_t)lround(fmax(0, e.x) / cfg.streamQuantum);
+  q.y = (uint32_t)lround(fmax(0, e.y) / cfg.streamQuantum);
+  q.radius = (uint32_t)lround(e.radius / cfg.streamQuantum);
+  q.flags = e.diet | e.status << 1;
+  return q;
+}
+
+bool byId(const streamQuanta_t& a, const streamQuanta_t& b) {
+  return a.id < b.id;
+}
+
+// Add a creature as a whole to a frame
+void putWhole(std::string& out, const streamQuanta_t& q, uint64_t* lastId) {
+  putVarint(out, q.id - *lastId);
+  putVarint(out, q.x);
+  putVarint(out, q.y);
+  putVarint(out, q.radius);
+  out += (char)q.flags;
+  *lastId = q.id;
+}
+
+// Put the length in front of a frame's bytes
+std::string framed(const std::string& body) {
+  std::string out;
+  putVarint(out, body.size());
+  return out + body;
+}
+
+// Encode a whole frame
+std::string keyFrame(int tick, const std::vector<streamQuanta_t>& now) {
+  std::string body = "K";
+  putVarint(body, tick);
+  putVarint(body, now.size());
+  uint64_t id = 0;
+  for (size_t i = 0; i < now.size(); i++) {
+    putWhole(body, now[i], &id);
+  }
+  return framed(body);
+}
+
+// Encode the changes from the last frame sent
+std::string deltaFrame(int tick, const std::vector<streamQuanta_t>& now) {
+  const std::vector<streamQuanta_t>& before = streamer.last;
+  std::string gone, came, moved;
+  size_t goneCount = 0, cameCount = 0, movedCount = 0;
+  uint64_t goneId = 0, cameId = 0, movedId = 0;
+
+  // Go along both frames at once, by id
+  size_t i = 0, j = 0;
+  while (i < before.size() || j < now.size()) {
+    if (j == now.size() || (i < before.size() && before[i].id < now[j].id)) {
+      putVarint(gone, before[i].id - goneId);
+      goneId = before[i++].id;
+      ++goneCount;
+    }
+    else if (i == before.size() || now[j].id < before[i].id) {
+      putWhole(came, now[j++], &cameId);
+      ++cameCount;
+    }
+    else {
+      const streamQuanta_t& a = before[i++];
+      const streamQuanta_t& b = now[j++];
+      if (a.x != b.x || a.y != b.y || a.flags != b.flags) {
+        putVarint(moved, b.id - movedId);
+        putSigned(moved, (int64_t)b.x - a.x);
+        putSigned(moved, (int64_t)b.y - a.y);
+        moved += (char)b.flags;
+        movedId = b.id;
+        ++movedCount;
+      }
+    }
+  }
+
+  std::string body = "D";
+  putVarint(body, tick);
+  putVarint(body, goneCount);
+  body += gone;
+  putVarint(body, cameCount);
+  body += came;
+  putVarint(body, movedCount);
+  body += moved;
+  return framed(body);
+}
+
+// Hand a subscriber's socket what it will take without waiting. Returns
+// false if the subscriber has gone
+bool flushSubscriber(subscriber_t& s) {
+  while (!s.pending.empty()) {
+    ssize_t n = send(s.fd, s.pending.data(), s.pending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    s.pending.erase(0, n);
+  }
+  return true;
+}
+
+// Take in everyone who has connected since the last frame
+void acceptSubscribers() {
+  while (true) {
+    int fd = accept4(streamer.listener, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      break;
+    }
+    subscriber_t s;
+    s.fd = fd;
+    s.synced = false;
+    s.pending = STREAM_MAGIC;
+    putVarint(s.pending, cfg.width);
+    putVarint(s.pending, cfg.height);
+    putVarint(s.pending, (uint64_t)lround(cfg.streamQuantum * 65536));
+    streamer.subscribers.push_back(s);
+  }
+}
+
+// Send one frame to everyone who can take it
+void sendFrame(int tick, streamFrame_t& frame) {
+  std::vector<streamQuanta_t> now(frame.size());
+  for (size_t i = 0; i < frame.size(); i++) {
+    now[i] = quantize(frame[i]);
+  }
+  std::sort(now.begin(), now.end(), byId);
+
+  acceptSubscribers();
+  std::string delta, key;
+  size_t kept = 0;
+  for (size_t k = 0; k < streamer.subscribers.size(); k++) {
+    subscriber_t& s = streamer.subscribers[k];
+    if (!flushSubscriber(s)) {
+      close(s.fd);
+      continue;
+    }
+    if (!s.pending.empty()) { // Still taking an earlier frame
+      s.synced = false;
+      ++streamer.missed;
+    }
+    else if (s.synced) {
+      if (delta.empty()) {
+        delta = deltaFrame(tick, now);
+      }
+      s.pending = delta;
+    }
+    else {
+      if (key.empty()) {
+        key = keyFrame(tick, now);
+      }
+      s.pending = key;
+      s.synced = true;
+    }
+    if (!flushSubscriber(s)) {
+      close(s.fd);
+      continue;
+    }
+    streamer.subscribers[kept++] = s;
+  }
+  streamer.subscribers.resize(kept);
+  streamer.last.swap(now);
+  ++streamer.sent;
+}
+
+// Open the socket, if streaming was asked for, and start sending. Every
+// process needs to know, to gather its creatures
+void startStream() {
+  streamer.on = !cfg.stream.empty();
+  if (!streamer.on || shardRank != 0) {
+    return;
+  }
+  streamer.listener = listenOn(cfg.stream, "the stream", &streamer.path);
+  fcntl(streamer.listener, F_SETFL, O_NONBLOCK); // Subscribers are taken in between frames
+  for (int i = 0; i < cfg.streamBuffers; i++) {
+    streamer.sender.spare.push_back(new streamFrame_t());
+  }
+  streamer.sent = streamer.skipped = streamer.missed = 0;
+  startHandOff(streamer.sender, sendFrame);
+}
+
+// Gather the creatures of every process after a tick, every
+// cfg.streamEvery ticks, and hand them to the sender if it is free
+void streamTick(int tick) {
+  if (!streamer.on || tick % cfg.streamEvery != 0) {
+    return;
+  }
+  streamFrame_t& mine = streamer.gathered;
+  mine.clear();
+  for (int r = firstRegion; r < lastRegion; r++) {
+    for (int i = 0; i < regions[r].creatures.size(); i++) {
+      creature* c = regions[r].creatures[i];
+      streamEntity_t e;
+      e.id = c->id();
+      e.x = c->pos().x();
+      e.y = c->pos().y();
+      e.radius = c->radius();
+      e.diet = c->food_source();
+      e.status = c->status();
+      mine.push_back(e);
+    }
+  }
+
+  message m;
+  if (shardRank != 0) {
+    m.put((uint64_t)mine.size());
+    for (size_t i = 0; i < mine.size(); i++) {
+      m.put(mine[i]);
+    }
+    send(0, m);
+    return;
+  }
+  for (int p = 1; p < shardCount; p++) {
+    receive(p, m);
+    size_t n = m.get<uint64_t>();
+    for (size_t i = 0; i < n; i++) {
+      mine.push_back(m.get<streamEntity_t>());
+    }
+  }
+
+  streamFrame_t* frame = takeSpare(streamer.sender, false);
+  if (frame == NULL) {
+    ++streamer.skipped;
+    return;
+  }
+  frame->swap(mine);
+  handOver(streamer.sender, tick, frame);
+}
+
+// Send the frames still waiting, and hang up on everyone
+void stopStream() {
+  if (!streamer.on || shardRank != 0) {
+    return;
+  }
+  stopHandOff(streamer.sender);
+  for (size_t k = 0; k < streamer.subscribers.size(); k++) {
+    close(streamer.subscribers[k].fd);
+  }
+  stopListening(streamer.listener, streamer.path);
+  printf("Streamed %ld frames, skipped %ld ticks, subscribers missed %ld frames\n",
+         streamer.sent, streamer.skipped, streamer.missed);
+}
+
+#endif
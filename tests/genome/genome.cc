@@ -0,0 +1,122 @@
+/* genome.cc checks the packed genome: that creatures are the same species *
+ * only while they differ in fewer than SPECIES_DISTANCE species bits, and *
+ * that a baby's bits come from its parents, with at most one flipped in   *
+ * each trait, and that creatures sharing a genome still plan in turns.   *
+ * Run it with make test                                                   */
+
+#include <cstdio>
+#include <stdint.h>
+
+#include "../../creature.hh"
+#include "../../random.hh"
+
+#define TRIALS 100000
+
+int failures = 0;
+
+// Note a failed check
+void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Get a genome differing from another in its lowest n species bits
+uint64_t flipSpeciesBits(uint64_t genome, int n) {
+  uint64_t bit = 1ULL << (8 * TRAIT_SIZE);
+  for (int flipped = 0; flipped < n; bit <<= 1) {
+    if (bit & SPECIES_MASK) {
+      genome ^= bit;
+      flipped++;
+    }
+  }
+  return genome;
+}
+
+// Check who can mate at and around the species distance
+void checkSpecies() {
+  uint64_t genome = creature::packGenome(0x5a, 0x12, 0x34, 0x56, 0x78);
+  creature c(HERBIVORE, genome, vec2d(10, 10), vec2d());
+  for (int n = 0; n <= SPECIES_DISTANCE + 2; n++) {
+    creature d(HERBIVORE, flipSpeciesBits(genome, n), vec2d(20, 20), vec2d());
+    char what[80];
+    snprintf(what, sizeof(what), "%d species bits apart is %s species", n,
+             n < SPECIES_DISTANCE ? "the same" : "another");
+    check(c.sameSpecies(&d) == (n < SPECIES_DISTANCE), what);
+    check(d.sameSpecies(&c) == c.sameSpecies(&d), "species is the same both ways");
+  }
+
+  // Color isn't part of the species, however much it differs
+  creature e(HERBIVORE, genome ^ 0xff, vec2d(30, 30), vec2d());
+  check(c.sameSpecies(&e), "color doesn't split species");
+  creature f(HERBIVORE, flipSpeciesBits(genome ^ 0xff, SPECIES_DISTANCE - 1), vec2d(40, 40), vec2d());
+  check(c.sameSpecies(&f), "color doesn't count towards the species distance");
+}
+
+// Check that babies take their bits from the parents, and mutate a little
+void checkBabies() {
+  seedRandom(1);
+  creature zeros(HERBIVORE, 0, vec2d(10, 10), vec2d());
+  creature ones(HERBIVORE, GENOME_MASK, vec2d(20, 20), vec2d());
+  long fromOnes = 0;
+  for (int t = 0; t < TRIALS; t++) {
+    uint64_t baby = new_genome(&zeros, &ones);
+    check((baby & ~GENOME_MASK) == 0, "babies have no bits past the traits");
+    fromOnes += __builtin_popcountll(baby);
+  }
+  double share = (double)fromOnes / TRIALS / 40;
+  check(share > 0.45 && share < 0.55, "babies take about half their bits from each parent");
+
+  // Where the parents agree, only mutations change the baby, a bit at most
+  // per trait, a quarter of the time, and any bit of the trait can flip
+  uint64_t genome = creature::packGenome(0x5a, 0x12, 0x34, 0x56, 0x78);
+  creature c(HERBIVORE, genome, vec2d(10, 10), vec2d());
+  creature d(HERBIVORE, genome, vec2d(20, 20), vec2d());
+  long mutated[NUM_TRAITS] = {};
+  uint64_t flipped = 0;
+  for (int t = 0; t < TRIALS; t++) {
+    uint64_t diff = new_genome(&c, &d) ^ genome;
+    flipped |= diff;
+    for (int i = 0; i < NUM_TRAITS; i++) {
+      int bits = __builtin_popcountll(diff >> (8 * i) & 0xff);
+      check(bits <= 1, "at most one bit of a trait mutates");
+      mutated[i] += bits;
+    }
+  }
+  for (int i = 0; i < NUM_TRAITS; i++) {
+    double rate = (double)mutated[i] / TRIALS;
+    check(rate > 0.23 && rate < 0.27, "a trait mutates a quarter of the time");
+  }
+  check(flipped == GENOME_MASK, "every bit of the genome can mutate");
+}
+
+// Check that creatures with one genome, like the first ones, are spread
+// evenly over the ticks they plan on
+void checkPlanPhases() {
+  uint64_t genome = creature::packGenome(128, 128, 128, 128, 128);
+  for (int period = 2; period <= 8; period++) {
+    long turns[8] = {};
+    for (int id = 1; id <= 8000; id++) {
+      creature c(HERBIVORE, genome, vec2d(10, 10), vec2d());
+      c.setId(id);
+      turns[c.planPhase(period)]++;
+    }
+    for (int k = 0; k < period; k++) {
+      double share = (double)turns[k] * period / 8000;
+      check(share > 0.9 && share < 1.1, "creatures sharing a genome plan in even turns");
+    }
+  }
+}
+
+int main() {
+  checkSpecies();
+  checkBabies();
+  checkPlanPhases();
+  if (failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All genome checks passed\n");
+  return 0;
+}
@@ -0,0 +1,71 @@
+/* pacing.cc checks the frame times pacing.hh reports: to 10 microseconds  *
+ * while frames keep to their period, and past the bins when they overrun, *
+ * where the percentiles must follow the frames rather than stop at the    *
+ * last bin. Run it with make test                                         */
+
+#include <cstdio>
+
+#include "../../pacing.hh"
+
+int failures = 0;
+
+// Note a failed check
+void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Start counting frame times again, at some frames a second
+void restart(int fps) {
+  cfg.fps = fps;
+  startPacing();
+}
+
+// Frames close to their period are told apart to a bin
+void checkSteadyFrames() {
+  restart(60);
+  for (int i = 0; i < 1000; i++) {
+    recordFrame(pacing.frameTimes, i < 990 ? 16.66 : 18.2);
+  }
+  frameTimes_t& t = pacing.frameTimes;
+  check(framePercentile(t, 0.5) >= 16.66 && framePercentile(t, 0.5) <= 16.67, "p50 is the usual frame, to a bin");
+  check(framePercentile(t, 0.99) <= 16.67, "p99 is still the usual frame");
+  check(framePercentile(t, 0.999) >= 18.2 && framePercentile(t, 0.999) <= 18.21, "p99.9 is the slow frame, to a bin");
+  check(t.max == 18.2, "max is the slowest frame");
+}
+
+// When every frame overruns by far, the percentiles follow the frames past
+// the bins, to a few percent, and never go over the longest
+void checkOverrunFrames() {
+  restart(500);
+  double cap = FRAME_BIN_PERIODS * 1000.0 / cfg.fps;
+  for (int i = 0; i < 1000; i++) {
+    recordFrame(pacing.frameTimes, 100 + i * 0.5);
+  }
+  frameTimes_t& t = pacing.frameTimes;
+  double p50 = framePercentile(t, 0.5), p99 = framePercentile(t, 0.99);
+  check(p50 > cap && p99 > cap, "percentiles of overrun frames are past the bins");
+  check(p50 > 350 * 0.95 && p50 < 350 * 1.2, "p50 of overrun frames is near the middle one");
+  check(p99 > 594.5 * 0.95 && p99 <= t.max, "p99 of overrun frames is near the slowest and no more");
+
+  // A few overruns among steady frames only move the tail
+  restart(500);
+  for (int i = 0; i < 1000; i++) {
+    recordFrame(pacing.frameTimes, i < 980 ? 2.0 : 613.0);
+  }
+  check(framePercentile(t, 0.5) <= 2.01, "p50 stays with the steady frames");
+  check(framePercentile(t, 0.99) > cap, "p99 sees the overruns");
+}
+
+int main() {
+  checkSteadyFrames();
+  checkOverrunFrames();
+  if (failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All pacing checks passed\n");
+  return 0;
+}
@@ -0,0 +1,76 @@
+/* steps.cc checks what lets ticks take long steps (--dt): that            *
+ * timeOfImpact() finds when two circles first touch along their steps,    *
+ * even when they would pass through each other between the ends, and that *
+ * a creature stopped partway by a meeting still goes its whole step. How  *
+ * the outcomes of whole runs compare with dt=1 is tools/compare-dt.sh's.  *
+ * Run it with make test                                                   */
+
+#include <cmath>
+#include <cstdio>
+
+#include "../../creature.hh"
+#include "../../integrate.hh"
+
+int failures = 0;
+
+// Note a failed check
+void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+bool near(double a, double b) {
+  return fabs(a - b) < 1e-9;
+}
+
+// Check the time of impact of circles moving in a few ways
+void checkTimeOfImpact() {
+  check(near(timeOfImpact(vec2d(10, 0), vec2d(-20, 0), 2), 0.4), "head on, they touch when the gap closes to the reach");
+  check(near(timeOfImpact(vec2d(10, 0), vec2d(-30, 0), 1), 0.3), "small and fast, they touch though they end apart");
+  check(near(timeOfImpact(vec2d(0, 10), vec2d(0, -8), 2), 1), "touching just at the end of the step counts");
+  check(timeOfImpact(vec2d(10, 0), vec2d(-7, 0), 2) < 0, "falling short doesn't count");
+  check(timeOfImpact(vec2d(1, 0), vec2d(5, 0), 2) == 0, "already touching is at the start");
+  check(timeOfImpact(vec2d(10, 0), vec2d(5, 0), 2) < 0, "moving apart never touches");
+  check(timeOfImpact(vec2d(10, 0), vec2d(0, 0), 2) < 0, "standing still never touches");
+  check(timeOfImpact(vec2d(10, 3), vec2d(-30, 0), 2) < 0, "passing by further than the reach never touches");
+
+  // Passing by closer than the reach: the gap is reach long when they touch
+  double t = timeOfImpact(vec2d(10, 1), vec2d(-30, 0), 2);
+  vec2d gap = vec2d(10, 1) + vec2d(-30, 0) * t;
+  check(t > 0 && t < 1 && near(sqrt(gap * gap), 2), "a glancing touch is found where the gap is the reach");
+}
+
+// Check that a step cut short by a meeting is made up after it
+void checkFinishStep() {
+  cfg.dt = 4;
+  v2d walls = {1000.0, 1000.0};
+  uint64_t genome = creature::packGenome(128, 128, 128, 128, 128);
+  creature c(HERBIVORE, genome, vec2d(500, 500), vec2d(1, 0));
+  creature d(HERBIVORE, genome, vec2d(500, 500), vec2d(1, 0));
+  c.move(walls);
+  d.move(walls);
+  vec2d whole = d.pos();
+
+  c.rewind(0.25);
+  c.rewind(0.5);
+  check(near(c.pos().x(), 500 + c.speed() / 8), "rewinding twice goes back through the shortened step");
+  c.finishStep();
+  check(near(c.pos().x(), whole.x()) && near(c.pos().y(), whole.y()), "a creature cut short still goes its whole step");
+  c.finishStep();
+  check(near(c.pos().x(), whole.x()), "a whole step isn't made up again");
+  d.finishStep();
+  check(near(d.pos().x(), whole.x()), "a step nobody cut short is left as it was");
+}
+
+int main() {
+  checkTimeOfImpact();
+  checkFinishStep();
+  if (failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All step checks passed\n");
+  return 0;
+}
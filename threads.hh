@@ -5,12 +5,14 @@
 #if !defined(THREADS_HH)
 #define THREADS_HH
 
+#include <atomic>
+#include <deque>
 #include <pthread.h>
 #include <thread>
+#include <utility>
+#include <vector>
 
-#include "creature.hh"
-
-#define MAXTHREADS 8
+#include "config.hh"
 
 
 //Takes from the task queue and runs the jobs it finds there.
@@ -33,7 +35,7 @@ typedef struct taskQueue {
 // Initializes the task queue
 void initTaskQueue(taskQueue * q);
 
-std::thread t[MAXTHREADS];
+std::vector<std::thread> t;
 
 taskQueue_t * q;
 
@@ -44,6 +46,9 @@ pthread_cond_t countCond;
 
 int tasksFinished = 0;
 
+// Tasks added and not yet taken by a thread
+std::atomic<int> tasksQueued(0);
+
 //Reset task by set taskFinished back to 0.
 void resetTasks(){
   pthread_mutex_lock(&countTasks);
@@ -63,8 +68,15 @@ void initTaskQueue(){
   q->head = NULL;
   q->tail = NULL;
 
-  for(int i = 0; i < MAXTHREADS; ++i){
-    t[i] = std::thread(queueRun);
+  for(int i = 0; i < cfg.threads; ++i){
+    t.push_back(std::thread(queueRun));
+  }
+}
+
+//Lets the threads go, so the program can exit while they wait for tasks.
+void stopTaskQueue(){
+  for(int i = 0; i < t.size(); ++i){
+    t[i].detach();
   }
 }
 
@@ -84,6 +96,7 @@ void queueRun(){
     else{
       node = q->head;
       q->head = q->head->next;
+      --tasksQueued;
 
       if(q->head == NULL){
         q->tail = NULL;
@@ -94,6 +107,7 @@ void queueRun(){
 
     if(node != NULL){
       node->task(node->i); //Run task;
+      free(node);
 
       pthread_mutex_lock(&countTasks);
       ++tasksFinished;
@@ -111,6 +125,7 @@ void addTask(void(*task)(int), int i){
   node->i = i;
 
   pthread_mutex_lock(&q->lock);
+  ++tasksQueued;
 
   if(q->tail != NULL){
     q->tail->next = node;
@@ -125,4 +140,115 @@ void addTask(void(*task)(int), int i){
   pthread_mutex_unlock(&q->lock);
 }
 
+//Run task(begin) .. task(end-1) on the pool and wait for all of them to finish
+void runTasks(void(*task)(int), int begin, int end){
+  resetTasks();
+  for(int i = begin; i < end; ++i){
+    addTask(task, i);
+  }
+
+  pthread_mutex_lock(&countTasks);
+  while(tasksFinished < end - begin){
+    pthread_cond_wait(&countCond, &countTasks);
+  }
+  pthread_mutex_unlock(&countTasks);
+}
+
+//Run task(0) .. task(n-1) on the pool and wait for all of them to finish
+void runTasks(void(*task)(int), int n){
+  runTasks(task, 0, n);
+}
+
+// Hands buffers of work (video frames, log blocks, stream frames) from the
+// simulation to a thread of its own, so slow output like the disk or a
+// socket doesn't hold the ticks up. The simulation takes a spare buffer,
+// fills it and hands it over with a tick; the thread does the work in
+// order and makes the buffer spare again. With only a few buffers, the
+// simulation decides what to do when none is spare: drop, wait or add one
+template<typename T>
+struct handOff {
+  std::deque<T*> spare;
+  std::deque<std::pair<int, T*> > waiting;
+  pthread_mutex_t lock;
+  pthread_cond_t more;  // Something is waiting, or it is time to stop
+  pthread_cond_t freed; // A buffer is spare again
+  bool stopping;
+  std::thread worker;
+  void (*work)(int tick, T& buffer);
+};
+
+// Do the work handed over as it comes, until told to stop and none is left
+template<typename T>
+void handOffLoop(handOff<T>* h) {
+  pthread_mutex_lock(&h->lock);
+  while (true) {
+    while (h->waiting.empty() && !h->stopping) {
+      pthread_cond_wait(&h->more, &h->lock);
+    }
+    if (h->waiting.empty()) {
+      break;
+    }
+    std::pair<int, T*> next = h->waiting.front();
+    h->waiting.pop_front();
+    pthread_mutex_unlock(&h->lock);
+
+    h->work(next.first, *next.second);
+
+    pthread_mutex_lock(&h->lock);
+    h->spare.push_back(next.second);
+    pthread_cond_signal(&h->freed);
+  }
+  pthread_mutex_unlock(&h->lock);
+}
+
+// Start the thread, with the buffers put in spare so far
+template<typename T>
+void startHandOff(handOff<T>& h, void (*work)(int, T&)) {
+  pthread_mutex_init(&h.lock, NULL);
+  pthread_cond_init(&h.more, NULL);
+  pthread_cond_init(&h.freed, NULL);
+  h.stopping = false;
+  h.work = work;
+  h.worker = std::thread(handOffLoop<T>, &h);
+}
+
+// Take a spare buffer, waiting for one if asked to. NULL if none is spare
+template<typename T>
+T* takeSpare(handOff<T>& h, bool wait) {
+  T* buffer = NULL;
+  pthread_mutex_lock(&h.lock);
+  while (wait && h.spare.empty()) {
+    pthread_cond_wait(&h.freed, &h.lock);
+  }
+  if (!h.spare.empty()) {
+    buffer = h.spare.front();
+    h.spare.pop_front();
+  }
+  pthread_mutex_unlock(&h.lock);
+  return buffer;
+}
+
+// Hand a filled buffer to the thread
+template<typename T>
+void handOver(handOff<T>& h, int tick, T* buffer) {
+  pthread_mutex_lock(&h.lock);
+  h.waiting.push_back(std::make_pair(tick, buffer));
+  pthread_cond_signal(&h.more);
+  pthread_mutex_unlock(&h.lock);
+}
+
+// Finish the work still waiting, stop the thread and free the buffers
+template<typename T>
+void stopHandOff(handOff<T>& h) {
+  pthread_mutex_lock(&h.lock);
+  h.stopping = true;
+  pthread_cond_signal(&h.more);
+  pthread_mutex_unlock(&h.lock);
+  h.worker.join();
+  while (!h.spare.empty()) {
+    delete h.spare.front();
+    h.spare.pop_front();
+  }
+}
+
 #endif
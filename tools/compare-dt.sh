@@ -0,0 +1,61 @@
+#!/bin/sh
+# compare-dt.sh runs one world headless at --dt=1 and at bigger steps, over
+# the same simulated time and several seeds, and compares how many creatures
+# were born, starved and were eaten. It fails if a bigger step is off by more
+# than TOLERANCE percent (10 by default) from the --dt=1 reference.
+#   tools/compare-dt.sh [FRAMES [DT...]]     from the top of the repo
+# EVO and LINEAGE name the programs to run, SEEDS the seeds, and any other
+# settings go in SETTINGS, one "name = value" a line.
+
+FRAMES=${1:-2000}
+[ $# -gt 0 ] && shift
+STEPS=${*:-2 4}
+EVO=${EVO:-./evo}
+LINEAGE=${LINEAGE:-tools/lineage}
+SEEDS=${SEEDS:-1 2 3 4 5 6 7 8 9 10 11 12}
+TOLERANCE=${TOLERANCE:-10}
+SETTINGS=${SETTINGS:-"width = 4000
+height = 4000
+herbivores = 3000
+carnivores = 300
+plant-rate = 16
+regions-x = 4
+regions-y = 4"}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# The first creatures are logged as born too
+founders=$(printf '%s\n' "$SETTINGS" | awk -F' *= *' '$1 == "herbivores" || $1 == "carnivores" { n += $2 } END { print n }')
+
+# Run every seed at one step, and print the born, starved and eaten totals
+run() {
+  for seed in $SEEDS; do
+    # A record without events replays as a plain run, headless, up to a tick
+    printf '%s\nseed = %s\n[events]\n' "$SETTINGS" "$seed" > "$dir/run.rec"
+    rm -f "$dir/run.lin"
+    "$EVO" --replay="$dir/run.rec" --replay-until=$((FRAMES / $1)) --replay-dump="$dir/dump.csv" \
+           --dt="$1" --lineage="$dir/run.lin" --data="$dir/data.csv" > /dev/null || exit 1
+    "$LINEAGE" species "$dir/run.lin" | tail -n +2
+  done | awk -F, -v founders="$founders" -v seeds="$(echo $SEEDS | wc -w)" \
+             '{ born += $7; starved += $8; eaten += $9 } END { print born - founders * seeds, starved, eaten }'
+}
+
+set -- $(run 1)
+echo "dt=1: $1 born, $2 starved, $3 eaten over $FRAMES frames"
+ref="$1 $2 $3"
+failed=0
+for dt in $STEPS; do
+  set -- $(run "$dt")
+  echo "$ref $1 $2 $3" | awk -v dt="$dt" -v tol="$TOLERANCE" '{
+    worst = 0
+    for (i = 1; i <= 3; i++) {
+      off[i] = $i > 0 ? 100 * ($(i + 3) - $i) / $i : 0
+      worst = off[i] < 0 ? (-off[i] > worst ? -off[i] : worst) : (off[i] > worst ? off[i] : worst)
+    }
+    printf "dt=%s: %d born (%+.1f%%), %d starved (%+.1f%%), %d eaten (%+.1f%%)\n",
+           dt, $4, off[1], $5, off[2], $6, off[3]
+    exit worst > tol
+  }' || failed=1
+done
+exit $failed
@@ -0,0 +1,201 @@
+/* lineage reads the logs written by evo --lineage=FILE (see lineage.hh).   *
+ *   ./lineage tree ID [DEPTH] FILE...   ancestors of a creature            *
+ *   ./lineage species FILE...           births and deaths of each species  *
+ * Give it the logs of every process, FILE FILE.1 FILE.2... Each is mapped  *
+ * into memory and gone over from start to end, never read in whole.        */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../lineage.hh"
+
+#define DEFAULT_DEPTH 6  // Generations of ancestors shown
+#define SPECIES_BITS 2   // Top bits of each trait that tell species apart
+
+// A log mapped into memory
+typedef struct logFile {
+  const lineageRecord_t* records;
+  size_t count;
+} logFile_t;
+
+// Every log, and where each creature's birth and death are in them
+std::vector<logFile_t> logs;
+std::unordered_map<uint64_t, const lineageRecord_t*> born;
+std::unordered_map<uint64_t, const lineageRecord_t*> died;
+
+// Map a log into memory, to be read from start to end
+void openLog(const char* path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    exit(1);
+  }
+  size_t header = sizeof(LINEAGE_MAGIC);
+  if ((size_t)st.st_size < header) {
+    fprintf(stderr, "%s is not a lineage log\n", path);
+    exit(1);
+  }
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED || memcmp(p, LINEAGE_MAGIC, header) != 0) {
+    fprintf(stderr, "%s is not a lineage log\n", path);
+    exit(1);
+  }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  logFile_t log;
+  log.records = (const lineageRecord_t*)((const char*)p + header);
+  log.count = (st.st_size - header) / sizeof(lineageRecord_t);
+  logs.push_back(log);
+}
+
+// Find every birth and death in the logs
+void indexLogs() {
+  for (size_t f = 0; f < logs.size(); f++) {
+    for (size_t i = 0; i < logs[f].count; i++) {
+      const lineageRecord_t* rec = &logs[f].records[i];
+      if (rec->kind == LINEAGE_BIRTH) {
+        born[rec->id] = rec;
+      }
+      else {
+        died[rec->id] = rec;
+      }
+    }
+  }
+}
+
+// Print a creature on one line: its diet, traits, and when it lived
+void printCreature(const lineageRecord_t* rec, int depth) {
+  printf("%*s#%llu %s color %d size %d speed %d energy %d vision %d, born at %u",
+         2 * depth, "", (unsigned long long)rec->id, rec->food == 0 ? "herbivore" : "carnivore",
+         (int)(rec->genome & 0xff), (int)(rec->genome >> 8 & 0xff), (int)(rec->genome >> 16 & 0xff),
+         (int)(rec->genome >> 24 & 0xff), (int)(rec->genome >> 32 & 0xff), rec->tick);
+  std::unordered_map<uint64_t, const lineageRecord_t*>::iterator d = died.find(rec->id);
+  if (d != died.end()) {
+    printf(", %s at %u", d->second->cause == DEATH_STARVED ? "starved" : "eaten", d->second->tick);
+  }
+  printf("\n");
+}
+
+// Print the ancestors of a creature, one generation further in at a time.
+// Inbreeding brings the same ancestors back, so each is shown in full once
+void printTree(uint64_t id, int depth, int maxDepth, std::unordered_set<uint64_t>& shown) {
+  std::unordered_map<uint64_t, const lineageRecord_t*>::iterator b = born.find(id);
+  if (b == born.end()) {
+    printf("%*s#%llu is not in the logs\n", 2 * depth, "", (unsigned long long)id);
+    return;
+  }
+  const lineageRecord_t* rec = b->second;
+  if (!shown.insert(id).second) {
+    printf("%*s#%llu, as above\n", 2 * depth, "", (unsigned long long)id);
+    return;
+  }
+  printCreature(rec, depth);
+  if (rec->parents[0] == 0 || depth == maxDepth) {
+    return;
+  }
+  printTree(rec->parents[0], depth + 1, maxDepth, shown);
+  printTree(rec->parents[1], depth + 1, maxDepth, shown);
+}
+
+// Births and deaths of one species
+typedef struct speciesCount {
+  long born;
+  long starved;
+  long eaten;
+} speciesCount_t;
+
+// Get the species of a creature: its diet and the top bits of its traits
+uint32_t speciesOf(const lineageRecord_t* rec) {
+  uint32_t key = rec->food;
+  for (int t = 0; t < 5; t++) {
+    key = key << SPECIES_BITS | (uint32_t)(rec->genome >> (8 * t + 8 - SPECIES_BITS) & ((1 << SPECIES_BITS) - 1));
+  }
+  return key;
+}
+
+// Count the births and deaths of each species, going over the logs once
+void printSpecies() {
+  std::map<uint32_t, speciesCount_t> counts;
+  for (size_t f = 0; f < logs.size(); f++) {
+    for (size_t i = 0; i < logs[f].count; i++) {
+      const lineageRecord_t* rec = &logs[f].records[i];
+      speciesCount_t& c = counts[speciesOf(rec)];
+      if (rec->kind == LINEAGE_BIRTH) {
+        ++c.born;
+      }
+      else if (rec->cause == DEATH_STARVED) {
+        ++c.starved;
+      }
+      else {
+        ++c.eaten;
+      }
+    }
+  }
+
+  // Traits are shown as the lowest value of their range
+  int shift = 8 - SPECIES_BITS;
+  int mask = (1 << SPECIES_BITS) - 1;
+  printf("Diet,Color,Size,Speed,Energy,Vision,Born,Starved,Eaten,Living\n");
+  for (std::map<uint32_t, speciesCount_t>::iterator it = counts.begin(); it != counts.end(); ++it) {
+    uint32_t key = it->first;
+    speciesCount_t& c = it->second;
+    printf("%s", key >> (5 * SPECIES_BITS) == 0 ? "herbivore" : "carnivore");
+    for (int t = 0; t < 5; t++) {
+      printf(",%d", (key >> (SPECIES_BITS * (4 - t)) & mask) << shift);
+    }
+    printf(",%ld,%ld,%ld,%ld\n", c.born, c.starved, c.eaten, c.born - c.starved - c.eaten);
+  }
+}
+
+void usage() {
+  fprintf(stderr, "Usage: lineage tree ID [DEPTH] FILE...\n"
+          "       lineage species FILE...\n");
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    usage();
+  }
+
+  if (!strcmp(argv[1], "tree")) {
+    if (argc < 4) {
+      usage();
+    }
+    uint64_t id = strtoull(argv[2], NULL, 10);
+    int depth = DEFAULT_DEPTH;
+    int first = 3;
+    if (access(argv[3], F_OK) != 0) { // A depth, not a file
+      depth = atoi(argv[3]);
+      first = 4;
+    }
+    for (int i = first; i < argc; i++) {
+      openLog(argv[i]);
+    }
+    indexLogs();
+    std::unordered_set<uint64_t> shown;
+    printTree(id, 0, depth, shown);
+  }
+  else if (!strcmp(argv[1], "species")) {
+    for (int i = 2; i < argc; i++) {
+      openLog(argv[i]);
+    }
+    printSpecies();
+  }
+  else {
+    usage();
+  }
+  return 0;
+}
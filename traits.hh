@@ -0,0 +1,191 @@
+/* traits.hh counts the traits of the creatures: for each diet, how many    *
+ * have each of the 256 values of each of the five traits. Each region is   *
+ * counted on its own, by the worker threads at once, and the counts added  *
+ * up after, so it takes a fraction of a walk over every creature. The      *
+ * telemetry takes its means from the counts, and --traits=FILE writes them *
+ * out whole every --traits-every ticks, with the mean, variance and        *
+ * diversity of each trait: its entropy in bits (8 when every value is as   *
+ * common, 0 when all share one) and the chance two creatures picked at     *
+ * random differ in it (Gini-Simpson).                                       */
+
+#if !defined(TRAITS_HH)
+#define TRAITS_HH
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "shard.hh"
+#include "threads.hh"
+#include "world.hh"
+
+#define TRAITS 5        // Traits in a genome, a byte each
+#define TRAIT_VALUES 256
+
+const char* traitNames[TRAITS] = { "color", "size", "speed", "energy", "vision" };
+
+// Counts of one region's creatures
+typedef struct regionTraits {
+  uint32_t counts[2][TRAITS][TRAIT_VALUES]; // By diet, trait and value
+} regionTraits_t;
+
+// Counts of a process's creatures, or of every process's
+typedef struct traitCounts {
+  long counts[2][TRAITS][TRAIT_VALUES];
+} traitCounts_t;
+
+typedef struct traitStats {
+  std::vector<regionTraits_t> regions;
+  traitCounts_t own;  // Our regions'
+  traitCounts_t all;  // Every process's, on the first one only
+  int countedAt;      // Tick the counts are of, so they are counted once a tick
+
+  FILE* out;
+} traitStats_t;
+
+traitStats_t traits;
+
+// Count the traits of a region's creatures
+void countRegionTraits(int r) {
+  regionTraits_t& t = traits.regions[r];
+  memset(&t, 0, sizeof(t));
+  for (int i = 0; i < regions[r].creatures.size(); i++) {
+    creature* c = regions[r].creatures[i];
+    uint64_t genome = c->genome();
+    uint32_t (*counts)[TRAIT_VALUES] = t.counts[c->food_source()];
+    for (int k = 0; k < TRAITS; k++) {
+      ++counts[k][genome >> (8 * k) & 0xff];
+    }
+  }
+}
+
+// Count the traits of our creatures after a tick, if they aren't yet
+void countTraits(int tick) {
+  if (traits.countedAt == tick) {
+    return;
+  }
+  traits.regions.resize(regions.size());
+  runTasks(&countRegionTraits, firstRegion, lastRegion);
+  memset(&traits.own, 0, sizeof(traits.own));
+  for (int r = firstRegion; r < lastRegion; r++) {
+    const uint32_t* from = &traits.regions[r].counts[0][0][0];
+    long* to = &traits.own.counts[0][0][0];
+    for (int i = 0; i < 2 * TRAITS * TRAIT_VALUES; i++) {
+      to[i] += from[i];
+    }
+  }
+  traits.countedAt = tick;
+}
+
+// Get how many of our creatures of a diet there are
+long dietCount(int diet) {
+  long n = 0;
+  for (int v = 0; v < TRAIT_VALUES; v++) {
+    n += traits.own.counts[diet][0][v];
+  }
+  return n;
+}
+
+// Get the sum of one trait over all our creatures
+long traitSum(int trait) {
+  long sum = 0;
+  for (int d = 0; d < 2; d++) {
+    for (int v = 0; v < TRAIT_VALUES; v++) {
+      sum += v * traits.own.counts[d][trait][v];
+    }
+  }
+  return sum;
+}
+
+// Open the file for the counts, if one was asked for
+void startTraits() {
+  traits.countedAt = -1;
+  traits.out = NULL;
+  if (cfg.traits.empty() || shardRank != 0) {
+    return;
+  }
+  traits.out = fopen(cfg.traits.c_str(), "w");
+  if (traits.out == NULL) {
+    fprintf(stderr, "Failed to open %s for the traits\n", cfg.traits.c_str());
+    exit(1);
+  }
+  fprintf(traits.out, "Tick,Diet,Trait,Count,Mean,Variance,Entropy,Simpson");
+  for (int v = 0; v < TRAIT_VALUES; v++) {
+    fprintf(traits.out, ",%d", v);
+  }
+  fprintf(traits.out, "\n");
+}
+
+// Write one trait of one diet: its statistics, then its counts
+void writeTrait(int tick, int diet, int trait) {
+  const long* counts = traits.all.counts[diet][trait];
+  long n = 0;
+  double sum = 0, squares = 0;
+  for (int v = 0; v < TRAIT_VALUES; v++) {
+    n += counts[v];
+    sum += (double)v * counts[v];
+    squares += (double)v * v * counts[v];
+  }
+  double mean = 0, variance = 0, entropy = 0, simpson = 0;
+  if (n > 0) {
+    mean = sum / n;
+    variance = fmax(0, squares / n - mean * mean);
+    simpson = 1;
+    for (int v = 0; v < TRAIT_VALUES; v++) {
+      double p = (double)counts[v] / n;
+      if (p > 0) {
+        entropy -= p * log2(p);
+      }
+      simpson -= p * p;
+    }
+  }
+  fprintf(traits.out, "%d,%s,%s,%ld,%.4f,%.4f,%.4f,%.4f", tick, diet == 0 ? "herbivore" : "carnivore",
+          traitNames[trait], n, mean, variance, entropy, simpson);
+  for (int v = 0; v < TRAIT_VALUES; v++) {
+    fprintf(traits.out, ",%ld", counts[v]);
+  }
+  fprintf(traits.out, "\n");
+}
+
+// After some ticks, add up every process's counts at the first and write them
+void writeTraits(int tick) {
+  if (cfg.traits.empty() || tick % cfg.traitsEvery != 0) {
+    return;
+  }
+  countTraits(tick);
+
+  message m;
+  if (shardRank != 0) {
+    m.put(traits.own);
+    send(0, m);
+    return;
+  }
+  traits.all = traits.own;
+  for (int p = 1; p < shardCount; p++) {
+    receive(p, m);
+    traitCounts_t part = m.get<traitCounts_t>();
+    long* to = &traits.all.counts[0][0][0];
+    const long* from = &part.counts[0][0][0];
+    for (int i = 0; i < 2 * TRAITS * TRAIT_VALUES; i++) {
+      to[i] += from[i];
+    }
+  }
+  for (int d = 0; d < 2; d++) {
+    for (int k = 0; k < TRAITS; k++) {
+      writeTrait(tick, d, k);
+    }
+  }
+}
+
+void stopTraits() {
+  if (traits.out != NULL) {
+    fclose(traits.out);
+  }
+}
+
+#endif
@@ -0,0 +1,80 @@
+/* view.hh is the camera: the rectangle of the world shown in the window.   *
+ * The arrow keys or dragging with the mouse move it, the mouse wheel or    *
+ * PageUp/PageDown zoom it around the cursor, and Home shows the whole      *
+ * world again. Only regions and creatures inside it are drawn, so drawing  *
+ * costs what is on screen, not what is in the world: regions the edge of   *
+ * the view cuts through are looked up in a grid for what is inside it.     */
+
+#if !defined(VIEW_HH)
+#define VIEW_HH
+
+#include <cmath>
+
+#include "config.hh"
+
+#define ZOOM_STEP 1.25    // How much one click of the wheel zooms
+#define MAX_ZOOM 64       // Most window pixels per world unit
+#define PAN_PIXELS 64     // How far one press of an arrow key moves
+
+typedef struct view {
+  double x, y;   // World position at the top left of the window
+  double scale;  // Window pixels per world unit
+} view_t;
+
+// What the window shows this frame
+view_t view;
+
+// Get the view of the whole world
+view_t wholeWorld() {
+  view_t v;
+  v.x = 0;
+  v.y = 0;
+  v.scale = fmin((double)cfg.windowWidth / cfg.width, (double)cfg.windowHeight / cfg.height);
+  return v;
+}
+
+// Keep a view from zooming out past the whole world or looking past its edges
+void clampView(view_t& v) {
+  v.scale = fmax(wholeWorld().scale, fmin(MAX_ZOOM, v.scale));
+  double w = cfg.width - cfg.windowWidth / v.scale;
+  double h = cfg.height - cfg.windowHeight / v.scale;
+  v.x = fmax(0, fmin(w, v.x));
+  v.y = fmax(0, fmin(h, v.y));
+}
+
+// Move a view by some window pixels
+void panView(view_t& v, double dx, double dy) {
+  v.x += dx / v.scale;
+  v.y += dy / v.scale;
+  clampView(v);
+}
+
+// Zoom a view, keeping the world under a window pixel where it is
+void zoomView(view_t& v, double factor, int px, int py) {
+  double wx = v.x + px / v.scale;
+  double wy = v.y + py / v.scale;
+  v.scale *= factor;
+  clampView(v);
+  v.x = wx - px / v.scale;
+  v.y = wy - py / v.scale;
+  clampView(v);
+}
+
+// Do two views show the same thing
+bool sameView(view_t& a, view_t& b) {
+  return a.x == b.x && a.y == b.y && a.scale == b.scale;
+}
+
+// Is any of a rectangle of the world in view
+bool inView(view_t& v, double x0, double y0, double x1, double y1) {
+  return x1 >= v.x && y1 >= v.y &&
+    x0 <= v.x + cfg.windowWidth / v.scale && y0 <= v.y + cfg.windowHeight / v.scale;
+}
+
+// Is all of a rectangle of the world in view
+bool allInView(view_t& v, double x0, double y0, double x1, double y1) {
+  return x0 >= v.x && y0 >= v.y &&
+    x1 <= v.x + cfg.windowWidth / v.scale && y1 <= v.y + cfg.windowHeight / v.scale;
+}
+
+#endif
@@ -0,0 +1,257 @@
+/* world.hh splits the world into rectangular regions. Each region owns the *
+ * creatures and plants inside it and is simulated by one task at a time.  *
+ * Creatures near a region's edge are also seen by the regions around it   *
+ * as ghosts, so perception and collisions never have to look further.     *
+ * When several processes share the world, each owns a stripe of region    *
+ * rows; the regions of other stripes only hold copies of their borders.   */
+
+#if !defined(WORLD_HH)
+#define WORLD_HH
+
+#include <vector>
+
+#include "config.hh"
+#include "creature.hh"
+#include "grid.hh"
+#include "mates.hh"
+
+// What a creature noticed about its surroundings this tick
+typedef struct perception {
+  bool threatened;  // Is a carnivore that can eat us in sight
+  vec2d away;       // Direction away from all visible threats
+  creature* mate;   // Nearest buddy for reproduction
+  creature* prey;   // Nearest herbivore a carnivore can eat
+  plant* food;      // Nearest plant an herbivore can eat
+  bool grazing;     // Is there richer grass in sight, with a food field
+  vec2d pasture;    // Where the richest grass in sight is
+} perception_t;
+
+// Two creatures that bumped into each other while looking for a buddy
+typedef struct mating {
+  creature* c;
+  creature* d;
+} mating_t;
+
+typedef struct region {
+  // The part of the world this region owns
+  double x0, y0, x1, y1;
+
+  // Creatures and plants inside the region
+  std::vector<creature*> creatures;
+  std::vector<plant*> plants;
+
+  // Creatures and plants close enough to the edge to be ghosts elsewhere.
+  // For a region of another process, these are copies and all we have of it
+  std::vector<creature*> border;
+  std::vector<plant*> borderPlants;
+
+  // Ghosts from other regions, and who owns each of them
+  std::vector<creature*> ghosts;
+  std::vector<int> ghostOwner;
+
+  // Our plants followed by the ghosts of other regions' plants
+  std::vector<plant*> nearbyPlants;
+
+  // Lookups over our creatures, the ghosts and the nearby plants
+  spatialGrid<creature> grid;
+  spatialGrid<creature> ghostGrid;
+  spatialGrid<plant> plantGrid;
+
+  // Does the edge of the view cut through the region, and lookups over our
+  // creatures and plants where they are drawn, built when it does
+  bool cut = false;
+  spatialGrid<creature> drawGrid;
+  spatialGrid<plant> drawPlantGrid;
+  mateIndex mates;
+
+  // The indices of the creatures around each of ours, where each was when
+  // its list was made, and how many of our creatures have a list (see neighbours.hh)
+  std::vector<std::vector<int> > neighbours;
+  std::vector<vec2d> listedAt;
+  int listed = 0;
+
+  // Indices of our herbivores and carnivores, so each diet runs as one batch
+  std::vector<int> dietIndices[2];
+
+  // Indices of our creatures that starved this tick
+  std::vector<int> starved;
+
+  // What each of our creatures saw this tick
+  std::vector<perception_t> seen;
+
+  // Buddies that met this tick; babies are made after every region is done
+  std::vector<mating_t> matings;
+
+  // Creatures leaving for each other region at the end of the tick
+  std::vector<std::vector<creature*> > outbox;
+} region_t;
+
+// All regions, row by row
+std::vector<region_t> regions;
+int regionCols;
+int regionRows;
+
+// The furthest any creature moves in one tick
+double maxStep;
+
+// How far into other regions a region has to see: a creature can mate twice
+// as far as its vision, and may move a little before collisions are checked
+double ghostBand;
+
+// The regions this process owns, and which process owns each region
+int firstRegion;
+int lastRegion;
+std::vector<int> regionOwner;
+
+// Get the region owning a position. Creatures outside the world belong to the edge
+int regionOf(vec2d pos) {
+  int col = (int)(pos.x() * regionCols / cfg.width);
+  int row = (int)(pos.y() * regionRows / cfg.height);
+  col = col < 0 ? 0 : (col >= regionCols ? regionCols - 1 : col);
+  row = row < 0 ? 0 : (row >= regionRows ? regionRows - 1 : row);
+  return row * regionCols + col;
+}
+
+// Is a position within the ghost band around a region
+bool inGhostBand(region_t& r, vec2d pos) {
+  return pos.x() >= r.x0 - ghostBand && pos.x() < r.x1 + ghostBand &&
+    pos.y() >= r.y0 - ghostBand && pos.y() < r.y1 + ghostBand;
+}
+
+// Is a position close enough to the edge of its own region to be a ghost elsewhere
+bool nearEdge(region_t& r, vec2d pos) {
+  return pos.x() < r.x0 + ghostBand || pos.x() >= r.x1 - ghostBand ||
+    pos.y() < r.y0 + ghostBand || pos.y() >= r.y1 - ghostBand;
+}
+
+// Can creatures of one region be ghosts in another
+bool inReach(region_t& a, region_t& b) {
+  return b.x0 < a.x1 + ghostBand && b.x1 > a.x0 - ghostBand &&
+    b.y0 < a.y1 + ghostBand && b.y1 > a.y0 - ghostBand;
+}
+
+// Is a region simulated by this process
+bool ownsRegion(int r) {
+  return r >= firstRegion && r < lastRegion;
+}
+
+// Split the world into regions. With no layout configured, aim for two
+// regions per thread no narrower than the ghost band, but when the world is
+// too small for that, keep cutting the longer side of the regions until
+// every thread has one; ghosts then come from further than the next region.
+// Every process needs at least one row of regions
+void initWorld() {
+  maxStep = SPEED_TABLE[255] * SIZE_SPEED_TABLE[0] / cfg.fps * cfg.dt;
+  ghostBand = 2 * (255 + cfg.maxRadius) + 2 * cfg.maxRadius + 2 * maxStep;
+
+  regionCols = cfg.regionsX;
+  regionRows = cfg.regionsY;
+  if (regionCols <= 0 || regionRows <= 0) {
+    int target = 2 * cfg.threads;
+    regionCols = (int)fmax(1, fmin(target, cfg.width / ghostBand));
+    regionRows = (int)fmax(1, fmin(target / regionCols, cfg.height / ghostBand));
+    regionRows = (int)fmax(regionRows, cfg.processes);
+    while (regionCols * regionRows < cfg.threads) {
+      if (cfg.width / regionCols >= cfg.height / regionRows) {
+        ++regionCols;
+      }
+      else {
+        ++regionRows;
+      }
+    }
+  }
+  if (regionRows < cfg.processes) {
+    fprintf(stderr, "Each of the %d processes needs a row of regions, there are %d\n",
+            cfg.processes, regionRows);
+    exit(1);
+  }
+
+  regions.resize(regionCols * regionRows);
+  for (int row = 0; row < regionRows; row++) {
+    for (int col = 0; col < regionCols; col++) {
+      region_t& r = regions[row * regionCols + col];
+      r.x0 = (double)cfg.width * col / regionCols;
+      r.x1 = (double)cfg.width * (col + 1) / regionCols;
+      r.y0 = (double)cfg.height * row / regionRows;
+      r.y1 = (double)cfg.height * (row + 1) / regionRows;
+      r.outbox.resize(regions.size());
+    }
+  }
+
+  // Until the world is split between processes, this one owns all of it
+  firstRegion = 0;
+  lastRegion = regions.size();
+  regionOwner.assign(regions.size(), 0);
+}
+
+// Keep only the stripe of region rows that one of several processes owns
+void setStripe(int process, int processes) {
+  for (int p = 0; p < processes; p++) {
+    int first = regionRows * p / processes * regionCols;
+    int last = regionRows * (p + 1) / processes * regionCols;
+    for (int r = first; r < last; r++) {
+      regionOwner[r] = p;
+    }
+    if (p == process) {
+      firstRegion = first;
+      lastRegion = last;
+    }
+  }
+
+  for (int r = 0; r < regions.size(); r++) {
+    if (ownsRegion(r)) {
+      continue;
+    }
+    for (int i = 0; i < regions[r].creatures.size(); i++) {
+      delete regions[r].creatures[i];
+    }
+    for (int i = 0; i < regions[r].plants.size(); i++) {
+      delete regions[r].plants[i];
+    }
+    regions[r].creatures.clear();
+    regions[r].plants.clear();
+  }
+}
+
+// Give a new creature to the region it was born in. A creature born in
+// another process's stripe is that process's to add
+void addCreature(creature* c) {
+  int r = regionOf(c->pos());
+  if (ownsRegion(r)) {
+    regions[r].creatures.push_back(c);
+  }
+  else {
+    delete c;
+  }
+}
+
+// Give a new plant to the region it grew in, if this process owns it
+void addPlant(plant* p) {
+  int r = regionOf(p->pos());
+  if (ownsRegion(r)) {
+    regions[r].plants.push_back(p);
+  }
+  else {
+    delete p;
+  }
+}
+
+// Count the creatures in every region
+size_t numCreatures() {
+  size_t n = 0;
+  for (int r = 0; r < regions.size(); r++) {
+    n += regions[r].creatures.size();
+  }
+  return n;
+}
+
+// Count the plants in every region
+size_t numPlants() {
+  size_t n = 0;
+  for (int r = 0; r < regions.size(); r++) {
+    n += regions[r].plants.size();
+  }
+  return n;
+}
+
+#endif